@@ -1,37 +1,226 @@
 #include "BVH.h"
+#include "RenderStats.h"
 
 #include <algorithm>
+#include <chrono>
+#include <future>
 
-BVH::BVH(std::vector<std::shared_ptr<SimplePrimitive>> primitives)
-    : m_Primitives(std::move(primitives))
+// Relative costs used by the SAH quality metric
+constexpr static float traversalCost = 0.125f;
+constexpr static float intersectionCost = 1.0f;
+
+// Subtrees rooted at this depth are refitted as independent tasks
+constexpr static int refitTaskDepth = 4;
+
+// Candidate split planes per axis for the SAH builders
+constexpr static int splitBuckets = 16;
+
+// Keeps the tree within the fixed traversal stack
+constexpr static int maxBuildDepth = 56;
+
+BVH::BVH(std::vector<std::shared_ptr<SimplePrimitive>> primitives, const BVHBuildOptions& options)
+    : m_BuildPrimitives(std::move(primitives)), m_Options(options)
 {
-    if (m_Primitives.empty()) return;
+    Build();
+}
 
-    std::vector<BVHPrimitiveInfo> primitiveInfos(m_Primitives.size());
+void BVH::Build()
+{
+    m_Nodes.clear();
+    m_MotionBounds.clear();
+    m_Primitives.clear();
+    if (m_BuildPrimitives.empty()) return;
 
-    for (size_t i = 0; i < m_Primitives.size(); i++)
+    // Animated primitives are partitioned by their swept bounds
+    m_HasMotion = false;
+    for (const auto& primitive : m_BuildPrimitives)
+        m_HasMotion |= primitive->IsAnimated();
+
+    std::vector<BVHPrimitiveInfo> primitiveInfos(m_BuildPrimitives.size());
+
+    AABB rootBounds;
+    for (size_t i = 0; i < m_BuildPrimitives.size(); i++)
     {
         primitiveInfos[i] = {
-            i, m_Primitives[i]->GetAABB()
+            i, m_BuildPrimitives[i]->GetAABB()
         };
+        rootBounds = AABB::Union(rootBounds, primitiveInfos[i].Bounds);
     }
 
+    // Clipped references only stay tight while the primitives are static
+    bool spatialSplits = m_Options.SplitMethod == BVHSplitMethod::SBVH && !m_HasMotion;
+    int duplicationBudget = spatialSplits ? (int)(m_BuildPrimitives.size() * m_Options.DuplicationBudget) : 0;
+
     std::vector<std::shared_ptr<SimplePrimitive>> orderedPrims;
-    orderedPrims.reserve(m_Primitives.size());
+    orderedPrims.reserve(m_BuildPrimitives.size() + duplicationBudget);
 
-    BVHBuildNodePool nodePool(m_Primitives.size() * 2 + 2);
+    BVHBuildNodePool nodePool((m_BuildPrimitives.size() + duplicationBudget) * 2 + 2);
     
     int totalNodes = 0;
     BVHBuildNode *root;
 
-    root = RecursiveBuild(nodePool, primitiveInfos, 0, m_Primitives.size(), &totalNodes, orderedPrims);
+    if (spatialSplits)
+    {
+        root = RecursiveBuildSpatial(nodePool, primitiveInfos, 0, rootBounds.SurfaceArea(), &totalNodes, &duplicationBudget, orderedPrims);
+    }
+    else
+    {
+        root = RecursiveBuild(nodePool, primitiveInfos, 0, m_BuildPrimitives.size(), 0, &totalNodes, orderedPrims);
+    }
+
+    m_Primitives = std::move(orderedPrims);
 
-    m_Primitives = orderedPrims;
+    if (m_Options.OptimizeTree)
+        OptimizeTree(root);
 
     m_Nodes.resize(totalNodes);
 
     int offset = 0;
     FlattenBVHTree(root, &offset);
+    SortLeavesByShape();
+
+    if (m_HasMotion)
+    {
+        m_MotionBounds.resize(m_Nodes.size());
+        RefitNodes();
+    }
+
+    BuildCompactNodes();
+    BuildLeafPrimitives();
+
+    m_BuildSAHCost = ComputeSAHCost();
+}
+
+bool BVH::Refit()
+{
+    if (m_Nodes.empty())
+        return false;
+
+    bool hasMotion = false;
+    for (const auto& primitive : m_Primitives)
+        hasMotion |= primitive->IsAnimated();
+    m_HasMotion = hasMotion;
+    m_MotionBounds.resize(m_HasMotion ? m_Nodes.size() : 0);
+
+    RefitNodes();
+    BuildCompactNodes();
+    BuildLeafPrimitives();
+
+    float cost = ComputeSAHCost();
+    if (cost > m_BuildSAHCost * m_RebuildThreshold)
+    {
+        std::cout << "BVH refit SAH cost " << cost << " exceeds " << m_RebuildThreshold
+                  << "x build cost " << m_BuildSAHCost << ", rebuilding" << std::endl;
+        Build();
+        return true;
+    }
+
+    return false;
+}
+
+void BVH::RefitNodes()
+{
+    std::vector<int> topNodes;
+    std::vector<int> taskRoots;
+    CollectRefitTasks(0, 0, topNodes, taskRoots);
+
+    // Disjoint subtrees can be refitted in parallel
+    std::vector<std::future<void>> futures;
+    for (int root : taskRoots)
+    {
+        futures.push_back(std::async(std::launch::async, [this, root]() {
+            RefitSubtree(root);
+        }));
+    }
+    for (auto& fut : futures)
+        fut.get();
+
+    // Top nodes are in pre-order, so walking backwards visits children before parents
+    for (auto it = topNodes.rbegin(); it != topNodes.rend(); ++it)
+    {
+        auto& node = m_Nodes[*it];
+        node.Bounds = AABB::Union(m_Nodes[*it + 1].Bounds, m_Nodes[node.SecondChildOffset].Bounds);
+        if (m_HasMotion)
+            m_MotionBounds[*it] = AABB::Union(m_MotionBounds[*it + 1], m_MotionBounds[node.SecondChildOffset]);
+    }
+}
+
+float BVH::ComputeSAHCost() const
+{
+    if (m_Nodes.empty())
+        return 0.0f;
+
+    float rootArea = m_Nodes[0].Bounds.SurfaceArea();
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    if (m_HasMotion)
+        rootArea = AABB::Lerp(m_Nodes[0].Bounds, m_MotionBounds[0], 0.5f).SurfaceArea();
+
+    float cost = 0.0f;
+    for (size_t i = 0; i < m_Nodes.size(); i++)
+    {
+        const auto& node = m_Nodes[i];
+        // Animated trees are measured at mid-shutter
+        float area = m_HasMotion ?
+            AABB::Lerp(node.Bounds, m_MotionBounds[i], 0.5f).SurfaceArea() :
+            node.Bounds.SurfaceArea();
+        if (node.nPrimitives > 0)
+            cost += area * node.nPrimitives * intersectionCost;
+        else
+            cost += area * traversalCost;
+    }
+
+    return cost / rootArea;
+}
+
+void BVH::RefitSubtree(int nodeIndex)
+{
+    auto& node = m_Nodes[nodeIndex];
+    if (node.nPrimitives > 0)
+    {
+        AABB bounds0, bounds1;
+        for (int i = 0; i < node.nPrimitives; i++)
+        {
+            auto& primitive = m_Primitives[node.PrimitivesOffset + i];
+            if (m_HasMotion)
+            {
+                AABB primBounds0, primBounds1;
+                primitive->GetLinearBounds(&primBounds0, &primBounds1);
+                bounds0 = AABB::Union(bounds0, primBounds0);
+                bounds1 = AABB::Union(bounds1, primBounds1);
+            }
+            else
+            {
+                bounds0 = AABB::Union(bounds0, primitive->GetAABB());
+            }
+        }
+        node.Bounds = bounds0;
+        if (m_HasMotion)
+            m_MotionBounds[nodeIndex] = bounds1;
+    }
+    else
+    {
+        RefitSubtree(nodeIndex + 1);
+        RefitSubtree(node.SecondChildOffset);
+        node.Bounds = AABB::Union(m_Nodes[nodeIndex + 1].Bounds, m_Nodes[node.SecondChildOffset].Bounds);
+        if (m_HasMotion)
+            m_MotionBounds[nodeIndex] = AABB::Union(m_MotionBounds[nodeIndex + 1], m_MotionBounds[node.SecondChildOffset]);
+    }
+}
+
+void BVH::CollectRefitTasks(int nodeIndex, int depth, std::vector<int>& topNodes, std::vector<int>& taskRoots) const
+{
+    const auto& node = m_Nodes[nodeIndex];
+    if (node.nPrimitives > 0 || depth == refitTaskDepth)
+    {
+        taskRoots.push_back(nodeIndex);
+        return;
+    }
+
+    topNodes.push_back(nodeIndex);
+    CollectRefitTasks(nodeIndex + 1, depth + 1, topNodes, taskRoots);
+    CollectRefitTasks(node.SecondChildOffset, depth + 1, topNodes, taskRoots);
 }
 
 void BVH::Intersect(const Ray& ray, SurfaceInteraction* intersect)
@@ -41,6 +230,275 @@ void BVH::Intersect(const Ray& ray, SurfaceInteraction* intersect)
         return;
     }
 
+    HitRecord hit;
+    if (IntersectHit(ray, std::numeric_limits<float>::max(), &hit))
+        ComputeInteraction(ray, hit, intersect);
+    else
+        intersect->HasIntersection = false;
+}
+
+void BVH::IntersectWithCost(const Ray& ray, SurfaceInteraction* intersect, TraversalCost& cost)
+{
+    if (m_Nodes.empty())
+    {
+        return;
+    }
+
+    HitRecord hit;
+    bool hasHit = !m_CompactNodes.empty() ? 
+        IntersectCompact<true>(ray, std::numeric_limits<float>::max(), &hit, &cost) : 
+        IntersectLinear<true>(ray, std::numeric_limits<float>::max(), &hit, &cost);
+    if (hasHit)
+        ComputeInteraction(ray, hit, intersect);
+    else
+        intersect->HasIntersection = false;
+}
+
+bool BVH::IntersectHit(const Ray& ray, float tMax, HitRecord* hit)
+{
+    if (m_Nodes.empty())
+        return false;
+
+    if (!m_CompactNodes.empty())
+        return IntersectCompact<false>(ray, tMax, hit, nullptr);
+    return IntersectLinear<false>(ray, tMax, hit, nullptr);
+}
+
+void BVH::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect)
+{
+    m_Primitives[hit.PrimitiveIndex]->ComputeInteraction(ray, hit, intersect);
+}
+
+// Stable within a leaf, the references of a leaf then form one run per shape
+void BVH::SortLeavesByShape()
+{
+    for (const auto& node : m_Nodes)
+    {
+        if (node.nPrimitives == 0)
+            continue;
+        auto first = m_Primitives.begin() + node.PrimitivesOffset;
+        std::stable_sort(first, first + node.nPrimitives, [](const auto& a, const auto& b) {
+            return a->GetShape().GetType() < b->GetShape().GetType();
+        });
+    }
+}
+
+static LeafPrimitive MakeLeafPrimitive(SimplePrimitive& primitive, std::vector<WorldQuad>& quads)
+{
+    LeafPrimitive leaf;
+    leaf.Geometry = TransformedPrimitive{};
+    if (primitive.IsAnimated())
+        return leaf;
+
+    // Rotation, translation and uniform scale only. Object space distances
+    // are then world distances divided by the scale.
+    auto transform = primitive.GetTransform();
+    const auto& mat = transform.GetMat();
+    glm::vec3 axes[3] = { glm::vec3(mat[0]), glm::vec3(mat[1]), glm::vec3(mat[2]) };
+    float scale = glm::length(axes[0]);
+    const float tolerance = 1e-4f * scale;
+    if (scale == 0.0f ||
+        fabs(glm::length(axes[1]) - scale) > tolerance ||
+        fabs(glm::length(axes[2]) - scale) > tolerance ||
+        fabs(glm::dot(axes[0], axes[1])) > tolerance * scale ||
+        fabs(glm::dot(axes[0], axes[2])) > tolerance * scale ||
+        fabs(glm::dot(axes[1], axes[2])) > tolerance * scale)
+        return leaf;
+
+    leaf.TMin = shapeTMin * scale;
+    auto normalMat = glm::mat3(glm::transpose(transform.GetInvMat()));
+    const auto& shape = primitive.GetShape();
+    switch (shape.GetType())
+    {
+    case ShapeType::Triangle:
+    {
+        const auto& triangle = static_cast<const Triangle&>(shape);
+        leaf.Geometry = WorldTriangle{
+            TransformPoint(mat, triangle.GetVertex(0)),
+            TransformPoint(mat, triangle.GetVertex(1)),
+            TransformPoint(mat, triangle.GetVertex(2))
+        };
+        break;
+    }
+    case ShapeType::MeshTriangle:
+    {
+        const auto& triangle = static_cast<const MeshTriangle&>(shape);
+        leaf.Geometry = WorldTriangle{
+            TransformPoint(mat, triangle.GetVertex(0)),
+            TransformPoint(mat, triangle.GetVertex(1)),
+            TransformPoint(mat, triangle.GetVertex(2))
+        };
+        break;
+    }
+    case ShapeType::Circle:
+    {
+        const auto& circle = static_cast<const Circle&>(shape);
+        leaf.Geometry = WorldSphere{ TransformPoint(mat, glm::vec3{ 0.0f }), circle.GetRadius() * scale };
+        break;
+    }
+    case ShapeType::Quad:
+    {
+        const auto& quad = static_cast<const Quad&>(shape);
+        leaf.Geometry = LeafQuad{ (uint32_t)quads.size() };
+        quads.push_back({
+            TransformPoint(mat, glm::vec3{ 0.0f }),
+            glm::normalize(normalMat * glm::vec3{ 0.0f, 1.0f, 0.0f }),
+            axes[0] / glm::dot(axes[0], axes[0]),
+            axes[2] / glm::dot(axes[2], axes[2]),
+            quad.GetWidth() / 2.0f,
+            quad.GetHeight() / 2.0f
+        });
+        break;
+    }
+    case ShapeType::InstancedMesh:
+        // Traverses its own object space BVH
+        break;
+    }
+    return leaf;
+}
+
+void BVH::BuildLeafPrimitives()
+{
+    m_LeafQuads.clear();
+    m_LeafPrimitives.resize(m_Primitives.size());
+    for (size_t i = 0; i < m_Primitives.size(); i++)
+        m_LeafPrimitives[i] = MakeLeafPrimitive(*m_Primitives[i], m_LeafQuads);
+}
+
+// The kernels below follow the object space tests in Shape.cpp. Distances are
+// along the unnormalized ray.Direction, hence the scaled TMin.
+
+static inline void IntersectGeometry(const WorldTriangle& triangle, const LeafPrimitive& primitive, uint32_t index, const LeafRay& ray, HitRecord& hit)
+{
+    float t, b1, b2;
+    if (!IntersectTriangleWatertight(ray, ray.Shear, triangle.P0, triangle.P1, triangle.P2, 
+        primitive.TMin * ray.InvDirLength, hit.T, &t, &b1, &b2))
+        return;
+
+    hit.T = t;
+    hit.PrimitiveIndex = index;
+    hit.B1 = b1;
+    hit.B2 = b2;
+}
+
+static inline void IntersectGeometry(const WorldSphere& sphere, const LeafPrimitive& primitive, uint32_t index, const LeafRay& ray, HitRecord& hit)
+{
+    auto l = ray.Origin - sphere.Center;
+    float a = glm::dot(ray.Direction, ray.Direction);
+    float b = 2.0f * glm::dot(l, ray.Direction);
+    float c = glm::dot(l, l) - sphere.Radius * sphere.Radius;
+
+    float discriminant = b * b - 4.0f * a * c;
+    if (discriminant < 0.0f)
+        return;
+
+    // t0 <= t1, the near root is a front face hit and the far one a hit from inside
+    float root = sqrtf(discriminant);
+    float t0 = (-b - root) / (2.0f * a);
+    float t1 = (-b + root) / (2.0f * a);
+    float tMin = primitive.TMin * ray.InvDirLength;
+
+    float t;
+    bool frontFace;
+    if (t0 >= tMin)
+    {
+        t = t0;
+        frontFace = true;
+    }
+    else if (t1 >= tMin)
+    {
+        t = t1;
+        frontFace = false;
+    }
+    else
+    {
+        return;
+    }
+
+    if (t >= hit.T)
+        return;
+
+    hit.T = t;
+    hit.PrimitiveIndex = index;
+    hit.IsFrontFace = frontFace;
+}
+
+static inline void IntersectGeometry(const WorldQuad& quad, const LeafPrimitive& primitive, uint32_t index, const LeafRay& ray, HitRecord& hit)
+{
+    float cosine = glm::dot(ray.Direction, quad.Normal);
+    if (fabs(cosine) < 1e-8f)
+        return;
+
+    float t = glm::dot(quad.Center - ray.Origin, quad.Normal) / cosine;
+    if (t <= primitive.TMin * ray.InvDirLength || t >= hit.T)
+        return;
+
+    auto offset = ray.Origin + ray.Direction * t - quad.Center;
+    float u = glm::dot(offset, quad.UAxis);
+    float v = glm::dot(offset, quad.VAxis);
+    if (u * u < quad.HalfWidth * quad.HalfWidth && v * v < quad.HalfHeight * quad.HalfHeight)
+    {
+        hit.T = t;
+        hit.PrimitiveIndex = index;
+    }
+}
+
+template<typename Geometry>
+static inline void IntersectRun(const LeafPrimitive* primitives, uint32_t first, uint32_t last, const LeafRay& ray, HitRecord& hit)
+{
+    for (uint32_t i = first; i < last; i++)
+        IntersectGeometry(*std::get_if<Geometry>(&primitives[i].Geometry), primitives[i], i, ray, hit);
+}
+
+template<bool countCost>
+void BVH::IntersectLeaf(int offset, int count, const LeafRay& ray, HitRecord& hit, TraversalCost* cost) const
+{
+    if constexpr (countCost)
+        cost->PrimitiveTests += count;
+
+    const LeafPrimitive* primitives = m_LeafPrimitives.data();
+    uint32_t first = (uint32_t)offset;
+    uint32_t last = first + (uint32_t)count;
+    // The object space fallback counts its own tests in Shape.cpp
+    uint32_t worldTests = 0;
+    while (first != last)
+    {
+        size_t type = primitives[first].Geometry.index();
+        uint32_t runEnd = first + 1;
+        while (runEnd != last && primitives[runEnd].Geometry.index() == type)
+            runEnd++;
+
+        switch (type)
+        {
+        case 0:
+            IntersectRun<WorldTriangle>(primitives, first, runEnd, ray, hit);
+            worldTests += runEnd - first;
+            break;
+        case 1:
+            IntersectRun<WorldSphere>(primitives, first, runEnd, ray, hit);
+            worldTests += runEnd - first;
+            break;
+        case 2:
+            for (uint32_t i = first; i < runEnd; i++)
+                IntersectGeometry(m_LeafQuads[std::get_if<LeafQuad>(&primitives[i].Geometry)->Index], primitives[i], i, ray, hit);
+            worldTests += runEnd - first;
+            break;
+        default:
+            for (uint32_t i = first; i < runEnd; i++)
+            {
+                if (m_Primitives[i]->IntersectHit(ray, hit.T, &hit))
+                    hit.PrimitiveIndex = i;
+            }
+            break;
+        }
+        first = runEnd;
+    }
+    RENDER_STAT_ADD(PrimitiveTests, worldTests);
+}
+
+template<bool countCost>
+bool BVH::IntersectLinear(const Ray& ray, float tMax, HitRecord* hit, TraversalCost* cost)
+{
     glm::vec3 invDir(1 / ray.Direction.x, 1 / ray.Direction.y, 1 / ray.Direction.z);
     int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
 
@@ -48,29 +506,22 @@ void BVH::Intersect(const Ray& ray, SurfaceInteraction* intersect)
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
 
-    float minDistance = std::numeric_limits<float>::max();
-    int minIndex = -1;
-    SurfaceInteraction minSurfaceInteraction;
+    LeafRay leafRay(ray);
+    HitRecord closest;
+    closest.T = tMax;
+    // Counted locally, the thread counters are touched once per ray
+    uint32_t nodesVisited = 0;
 
     while (true) {
         const LinearBVHNode *node = &m_Nodes[currentNodeIndex];
-        // Check ray against BVH node
-        if (node->Bounds.IntersectP(ray)) {
+        nodesVisited++;
+        // Check ray against BVH node, animated trees interpolate the bounds to the ray time
+        bool hitNode = m_HasMotion ?
+            AABB::Lerp(node->Bounds, m_MotionBounds[currentNodeIndex], ray.Time).IntersectP(ray) :
+            node->Bounds.IntersectP(ray);
+        if (hitNode) {
             if (node->nPrimitives > 0) {
-                // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i)
-                {
-                    SurfaceInteraction si;
-                    m_Primitives[node->PrimitivesOffset + i]->Intersect(ray, &si);
-                    auto disVec = ray.Origin - si.Position;
-                    auto distance2 = glm::dot(disVec, disVec);
-                    if (si.HasIntersection && distance2 < minDistance)
-                    {
-                        minDistance = distance2;
-                        minIndex = 0;
-                        minSurfaceInteraction = si;
-                    }
-                }
+                IntersectLeaf<countCost>(node->PrimitivesOffset, node->nPrimitives, leafRay, closest, cost);
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -89,14 +540,15 @@ void BVH::Intersect(const Ray& ray, SurfaceInteraction* intersect)
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    RENDER_STAT_ADD(NodesVisited, nodesVisited);
+    if constexpr (countCost)
+        cost->NodesVisited += nodesVisited;
 
-    if (minIndex >= 0)
-    {
-        *intersect = minSurfaceInteraction;
-        return;
-    }
+    if (closest.T == tMax)
+        return false;
 
-    intersect->HasIntersection = false;
+    *hit = closest;
+    return true;
 }
 
 void BVH::Traverse(std::function<void(int, const AABB&)> callback)
@@ -133,6 +585,7 @@ BVHBuildNode* BVH::RecursiveBuild(
     std::vector<BVHPrimitiveInfo>& primitiveInfo, 
     int start, 
     int end, 
+    int depth,
     int *totalNodes,
     std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
 )
@@ -146,16 +599,9 @@ BVHBuildNode* BVH::RecursiveBuild(
         bounds = AABB::Union(bounds, primitiveInfo[i].Bounds);
 
     int nPrimitives = end - start;
-    if (nPrimitives == 1)
+    if (nPrimitives == 1 || depth >= maxBuildDepth)
     {
-        int firstPrimOffset = orderedPrims.size();
-        for (int i = start; i < end; i++)
-        {
-            int primNum = primitiveInfo[i].PrimitiveIndex;
-            orderedPrims.push_back(m_Primitives[primNum]);
-        }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-        return node;
+        return MakeLeaf(node, &primitiveInfo[start], nPrimitives, bounds, orderedPrims);
     }
     else
     {
@@ -169,18 +615,11 @@ BVHBuildNode* BVH::RecursiveBuild(
         int mid = (start + end) / 2;
         if (centroidBounds.Max[dim] == centroidBounds.Min[dim])
         {
-            int firstPrimOffset = orderedPrims.size();
-            for (int i = start; i < end; ++i) {
-                int primNum = primitiveInfo[i].PrimitiveIndex;
-                orderedPrims.push_back(m_Primitives[primNum]);
-            }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-            return node;
+            return MakeLeaf(node, &primitiveInfo[start], nPrimitives, bounds, orderedPrims);
         }
         else
         {
-            int method = 1;
-            if (method == 0)
+            if (m_Options.SplitMethod == BVHSplitMethod::EqualCounts)
             {
                 // Partition primitives into equally-sized subsets
                 mid = (start + end) / 2;
@@ -193,19 +632,39 @@ BVHBuildNode* BVH::RecursiveBuild(
             }
             else
             {
-                 // Partition primitives into equally-sized subsets
-                mid = (start + end) / 2;
-                std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
-                    &primitiveInfo[end - 1] + 1,
-                    [dim](const BVHPrimitiveInfo &a,
-                        const BVHPrimitiveInfo &b) {
-                        return a.Centroid[dim] < b.Centroid[dim];
-                    });
+                // Partition primitives at the cheapest SAH bucket boundary
+                auto split = FindObjectSplit(&primitiveInfo[start], nPrimitives, centroidBounds);
+                float leafCost = nPrimitives * intersectionCost;
+                float splitCost = traversalCost + split.Cost / bounds.SurfaceArea();
+                if (nPrimitives <= m_Options.MaxPrimsInLeaf && leafCost <= splitCost)
+                    return MakeLeaf(node, &primitiveInfo[start], nPrimitives, bounds, orderedPrims);
+
+                if (split.Axis < 0)
+                {
+                    // Every bucket cost overflowed, split at the median instead
+                    std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
+                        &primitiveInfo[end - 1] + 1,
+                        [dim](const BVHPrimitiveInfo &a,
+                            const BVHPrimitiveInfo &b) {
+                            return a.Centroid[dim] < b.Centroid[dim];
+                        });
+                }
+                else
+                {
+                    dim = split.Axis;
+                    auto pmid = std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                        [&](const BVHPrimitiveInfo &pi) {
+                            return pi.Centroid[split.Axis] < split.Position;
+                        });
+                    mid = pmid - &primitiveInfo[0];
+                    if (mid == start || mid == end)
+                        mid = (start + end) / 2;
+                }
             }
             
             node->InitInterior(dim, 
-                RecursiveBuild(nodePool, primitiveInfo, start, mid, totalNodes, orderedPrims),
-                RecursiveBuild(nodePool, primitiveInfo, mid, end, totalNodes, orderedPrims)
+                RecursiveBuild(nodePool, primitiveInfo, start, mid, depth + 1, totalNodes, orderedPrims),
+                RecursiveBuild(nodePool, primitiveInfo, mid, end, depth + 1, totalNodes, orderedPrims)
             );
             
         }
@@ -215,6 +674,466 @@ BVHBuildNode* BVH::RecursiveBuild(
     return node;
 }
 
+BVHBuildNode* BVH::RecursiveBuildSpatial(
+    BVHBuildNodePool& nodePool,
+    std::vector<BVHPrimitiveInfo>& references,
+    int depth,
+    float rootArea,
+    int *totalNodes,
+    int *duplicationBudget,
+    std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
+)
+{
+    BVHBuildNode* node = nodePool.GetNode();
+
+    (*totalNodes)++;
+
+    AABB bounds, centroidBounds;
+    for (const auto& reference : references)
+    {
+        bounds = AABB::Union(bounds, reference.Bounds);
+        centroidBounds = AABB::Union(centroidBounds, reference.Centroid);
+    }
+
+    int nReferences = (int)references.size();
+    if (nReferences == 1 || depth >= maxBuildDepth)
+        return MakeLeaf(node, references.data(), nReferences, bounds, orderedPrims);
+
+    float area = bounds.SurfaceArea();
+    float leafCost = nReferences * intersectionCost;
+
+    auto objectSplit = FindObjectSplit(references.data(), nReferences, centroidBounds);
+
+    // Spatial splits only pay off where the object split children overlap
+    BVHSplit spatialSplit;
+    if (*duplicationBudget > 0 && objectSplit.Axis >= 0)
+    {
+        auto overlap = AABB::Intersect(objectSplit.LeftBounds, objectSplit.RightBounds);
+        if (!overlap.IsEmpty() && overlap.SurfaceArea() > m_Options.SpatialSplitAlpha * rootArea)
+            spatialSplit = FindSpatialSplit(references, bounds);
+    }
+    else if (*duplicationBudget > 0 && objectSplit.Axis < 0)
+    {
+        // Coincident centroids, only a spatial split can separate the references
+        spatialSplit = FindSpatialSplit(references, bounds);
+    }
+
+    // Every straddling reference is duplicated, skip splits that do not fit the budget
+    if (spatialSplit.Axis >= 0 && spatialSplit.LeftCount + spatialSplit.RightCount - nReferences > *duplicationBudget)
+        spatialSplit = BVHSplit();
+
+    float splitCost = traversalCost + std::min(objectSplit.Cost, spatialSplit.Cost) / area;
+    if ((nReferences <= m_Options.MaxPrimsInLeaf && leafCost <= splitCost) || 
+        (objectSplit.Axis < 0 && spatialSplit.Axis < 0))
+        return MakeLeaf(node, references.data(), nReferences, bounds, orderedPrims);
+
+    std::vector<BVHPrimitiveInfo> left, right;
+    int axis = -1;
+
+    if (spatialSplit.Cost < objectSplit.Cost)
+    {
+        axis = spatialSplit.Axis;
+        float position = spatialSplit.Position;
+        for (const auto& reference : references)
+        {
+            if (reference.Bounds.Max[axis] <= position)
+            {
+                left.push_back(reference);
+            }
+            else if (reference.Bounds.Min[axis] >= position)
+            {
+                right.push_back(reference);
+            }
+            else
+            {
+                // Straddling reference, keep it whole on one side when that is
+                // cheaper than clipping it into both children
+                float leftArea = spatialSplit.LeftBounds.SurfaceArea();
+                float rightArea = spatialSplit.RightBounds.SurfaceArea();
+                float splitRefCost = leftArea * spatialSplit.LeftCount + rightArea * spatialSplit.RightCount;
+                float leftOnlyCost = 
+                    AABB::Union(spatialSplit.LeftBounds, reference.Bounds).SurfaceArea() * spatialSplit.LeftCount +
+                    rightArea * (spatialSplit.RightCount - 1);
+                float rightOnlyCost = 
+                    leftArea * (spatialSplit.LeftCount - 1) +
+                    AABB::Union(spatialSplit.RightBounds, reference.Bounds).SurfaceArea() * spatialSplit.RightCount;
+
+                if (leftOnlyCost < splitRefCost && leftOnlyCost <= rightOnlyCost)
+                {
+                    left.push_back(reference);
+                    continue;
+                }
+                if (rightOnlyCost < splitRefCost)
+                {
+                    right.push_back(reference);
+                    continue;
+                }
+
+                auto& primitive = m_BuildPrimitives[reference.PrimitiveIndex];
+                AABB leftClip = reference.Bounds;
+                AABB rightClip = reference.Bounds;
+                leftClip.Max[axis] = position;
+                rightClip.Min[axis] = position;
+                auto leftBounds = primitive->GetClippedAABB(leftClip);
+                auto rightBounds = primitive->GetClippedAABB(rightClip);
+
+                if (leftBounds.IsEmpty())
+                {
+                    right.push_back(reference);
+                }
+                else if (rightBounds.IsEmpty())
+                {
+                    left.push_back(reference);
+                }
+                else
+                {
+                    left.push_back({ reference.PrimitiveIndex, leftBounds });
+                    right.push_back({ reference.PrimitiveIndex, rightBounds });
+                    (*duplicationBudget)--;
+                }
+            }
+        }
+
+        if (left.empty() || right.empty())
+        {
+            left.clear();
+            right.clear();
+            axis = -1;
+        }
+    }
+
+    if (axis < 0)
+    {
+        if (objectSplit.Axis < 0)
+            return MakeLeaf(node, references.data(), nReferences, bounds, orderedPrims);
+
+        axis = objectSplit.Axis;
+        for (const auto& reference : references)
+        {
+            if (reference.Centroid[axis] < objectSplit.Position)
+                left.push_back(reference);
+            else
+                right.push_back(reference);
+        }
+
+        if (left.empty() || right.empty())
+            return MakeLeaf(node, references.data(), nReferences, bounds, orderedPrims);
+    }
+
+    // The parent references are no longer needed once the children are built
+    references.clear();
+    references.shrink_to_fit();
+
+    auto c0 = RecursiveBuildSpatial(nodePool, left, depth + 1, rootArea, totalNodes, duplicationBudget, orderedPrims);
+    auto c1 = RecursiveBuildSpatial(nodePool, right, depth + 1, rootArea, totalNodes, duplicationBudget, orderedPrims);
+    node->InitInterior(axis, c0, c1);
+
+    return node;
+}
+
+BVHSplit BVH::FindObjectSplit(const BVHPrimitiveInfo* references, int count, const AABB& centroidBounds) const
+{
+    struct Bucket
+    {
+        int Count = 0;
+        AABB Bounds;
+    };
+
+    BVHSplit best;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float cmin = centroidBounds.Min[axis];
+        float cmax = centroidBounds.Max[axis];
+        if (cmax <= cmin)
+            continue;
+
+        Bucket buckets[splitBuckets];
+        for (int i = 0; i < count; i++)
+        {
+            int b = (int)(splitBuckets * (references[i].Centroid[axis] - cmin) / (cmax - cmin));
+            b = std::min(b, splitBuckets - 1);
+            buckets[b].Count++;
+            buckets[b].Bounds = AABB::Union(buckets[b].Bounds, references[i].Bounds);
+        }
+
+        // Sweep from the right to get the bounds of every right partition
+        AABB rightBounds[splitBuckets];
+        int rightCounts[splitBuckets];
+        AABB accumulated;
+        int accumulatedCount = 0;
+        for (int b = splitBuckets - 1; b > 0; b--)
+        {
+            accumulated = AABB::Union(accumulated, buckets[b].Bounds);
+            accumulatedCount += buckets[b].Count;
+            rightBounds[b] = accumulated;
+            rightCounts[b] = accumulatedCount;
+        }
+
+        AABB leftBounds;
+        int leftCount = 0;
+        for (int b = 0; b < splitBuckets - 1; b++)
+        {
+            leftBounds = AABB::Union(leftBounds, buckets[b].Bounds);
+            leftCount += buckets[b].Count;
+            if (leftCount == 0 || rightCounts[b + 1] == 0)
+                continue;
+
+            float cost = 
+                leftCount * leftBounds.SurfaceArea() * intersectionCost + 
+                rightCounts[b + 1] * rightBounds[b + 1].SurfaceArea() * intersectionCost;
+            if (cost < best.Cost)
+            {
+                best.Cost = cost;
+                best.Axis = axis;
+                best.Bin = b;
+                best.Position = cmin + (cmax - cmin) * (b + 1) / splitBuckets;
+                best.LeftBounds = leftBounds;
+                best.RightBounds = rightBounds[b + 1];
+                best.LeftCount = leftCount;
+                best.RightCount = rightCounts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+BVHSplit BVH::FindSpatialSplit(const std::vector<BVHPrimitiveInfo>& references, const AABB& bounds) const
+{
+    struct Bin
+    {
+        AABB Bounds;
+        int Entries = 0;
+        int Exits = 0;
+    };
+
+    BVHSplit best;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float bmin = bounds.Min[axis];
+        float bmax = bounds.Max[axis];
+        float binWidth = (bmax - bmin) / splitBuckets;
+        if (binWidth <= 0.0f)
+            continue;
+
+        auto binOf = [&](float x) {
+            int b = (int)((x - bmin) / binWidth);
+            return std::clamp(b, 0, splitBuckets - 1);
+        };
+
+        Bin bins[splitBuckets];
+        for (const auto& reference : references)
+        {
+            int firstBin = binOf(reference.Bounds.Min[axis]);
+            int lastBin = binOf(reference.Bounds.Max[axis]);
+            auto& primitive = m_BuildPrimitives[reference.PrimitiveIndex];
+
+            if (firstBin == lastBin)
+            {
+                bins[firstBin].Bounds = AABB::Union(bins[firstBin].Bounds, reference.Bounds);
+            }
+            else
+            {
+                // Chop the reference into the bins it spans
+                for (int b = firstBin; b <= lastBin; b++)
+                {
+                    AABB slab = reference.Bounds;
+                    slab.Min[axis] = std::max(slab.Min[axis], bmin + b * binWidth);
+                    slab.Max[axis] = std::min(slab.Max[axis], b == splitBuckets - 1 ? bmax : bmin + (b + 1) * binWidth);
+                    auto clipped = primitive->GetClippedAABB(slab);
+                    if (!clipped.IsEmpty())
+                        bins[b].Bounds = AABB::Union(bins[b].Bounds, clipped);
+                }
+            }
+
+            bins[firstBin].Entries++;
+            bins[lastBin].Exits++;
+        }
+
+        AABB rightBounds[splitBuckets];
+        int rightCounts[splitBuckets];
+        AABB accumulated;
+        int accumulatedCount = 0;
+        for (int b = splitBuckets - 1; b > 0; b--)
+        {
+            accumulated = AABB::Union(accumulated, bins[b].Bounds);
+            accumulatedCount += bins[b].Exits;
+            rightBounds[b] = accumulated;
+            rightCounts[b] = accumulatedCount;
+        }
+
+        AABB leftBounds;
+        int leftCount = 0;
+        for (int b = 0; b < splitBuckets - 1; b++)
+        {
+            leftBounds = AABB::Union(leftBounds, bins[b].Bounds);
+            leftCount += bins[b].Entries;
+            if (leftCount == 0 || rightCounts[b + 1] == 0)
+                continue;
+
+            float cost = 
+                leftCount * leftBounds.SurfaceArea() * intersectionCost + 
+                rightCounts[b + 1] * rightBounds[b + 1].SurfaceArea() * intersectionCost;
+            if (cost < best.Cost)
+            {
+                best.Cost = cost;
+                best.Axis = axis;
+                best.Bin = b;
+                best.Position = bmin + (b + 1) * binWidth;
+                best.LeftBounds = leftBounds;
+                best.RightBounds = rightBounds[b + 1];
+                best.LeftCount = leftCount;
+                best.RightCount = rightCounts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+BVHBuildNode* BVH::MakeLeaf(
+    BVHBuildNode* node,
+    const BVHPrimitiveInfo* references,
+    int count,
+    const AABB& bounds,
+    std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
+)
+{
+    int firstPrimOffset = orderedPrims.size();
+    for (int i = 0; i < count; i++)
+    {
+        int primNum = references[i].PrimitiveIndex;
+        orderedPrims.push_back(m_BuildPrimitives[primNum]);
+    }
+    node->InitLeaf(firstPrimOffset, count, bounds);
+    return node;
+}
+
+void BVH::OptimizeTree(BVHBuildNode* root)
+{
+    if (root->nPrimitives > 0)
+        return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    float rootArea = root->Bounds.SurfaceArea();
+    float initialCost = ComputeBuildTreeCost(root) / rootArea;
+    float cost = initialCost;
+
+    int passes = 0;
+    while (passes < m_Options.OptimizeMaxPasses)
+    {
+        passes++;
+        if (!RotatePass(root, 0))
+            break;
+
+        // Stop once a pass no longer makes a noticeable difference
+        float newCost = ComputeBuildTreeCost(root) / rootArea;
+        bool converged = cost - newCost < cost * 1e-3f;
+        cost = newCost;
+        if (converged)
+            break;
+
+        if (m_Options.OptimizeTimeBudgetMs > 0.0f &&
+            std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count() >= m_Options.OptimizeTimeBudgetMs)
+            break;
+    }
+
+    cost = ComputeBuildTreeCost(root) / rootArea;
+    auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    std::cout << "BVH rotations: SAH " << initialCost << " -> " << cost 
+              << " (" << (initialCost - cost) / initialCost * 100.0f << "% lower) in "
+              << passes << " passes, " << elapsed << " ms" << std::endl;
+}
+
+bool BVH::RotatePass(BVHBuildNode* node, int depth)
+{
+    if (node->nPrimitives > 0)
+        return false;
+
+    // Bottom-up, so improvements below are visible to the rotations above
+    bool rotated = RotatePass(node->Children[0], depth + 1);
+    rotated |= RotatePass(node->Children[1], depth + 1);
+    node->Height = 1 + std::max(node->Children[0]->Height, node->Children[1]->Height);
+
+    rotated |= TryRotate(node, depth);
+    return rotated;
+}
+
+// Picks a split axis for an interior node from the separation of its children
+// and orders them so the traversal's near/far choice stays meaningful
+static void UpdateSplitAxis(BVHBuildNode* node)
+{
+    auto c0 = .5f * node->Children[0]->Bounds.Min + .5f * node->Children[0]->Bounds.Max;
+    auto c1 = .5f * node->Children[1]->Bounds.Min + .5f * node->Children[1]->Bounds.Max;
+    auto d = glm::abs(c1 - c0);
+    int axis = (d.x >= d.y && d.x >= d.z) ? 0 : (d.y >= d.z ? 1 : 2);
+    if (c1[axis] < c0[axis])
+        std::swap(node->Children[0], node->Children[1]);
+    node->SplitAxis = axis;
+}
+
+bool BVH::TryRotate(BVHBuildNode* node, int depth)
+{
+    // Swapping a child with a grandchild only changes the bounds of the other
+    // child, every moved subtree keeps its own cost
+    float bestDelta = 0.0f;
+    int bestChild = -1, bestGrandchild = -1;
+
+    for (int c = 0; c < 2; c++)
+    {
+        auto* sibling = node->Children[1 - c];
+        if (sibling->nPrimitives > 0)
+            continue;
+
+        float siblingArea = sibling->Bounds.SurfaceArea();
+        for (int g = 0; g < 2; g++)
+        {
+            // The sibling keeps grandchild 1 - g and receives our child c
+            // Every rotation sinks the child by a level, the traversal stacks
+            // only hold maxBuildDepth levels
+            int siblingHeight = 1 + std::max(node->Children[c]->Height, sibling->Children[1 - g]->Height);
+            int height = 1 + std::max(siblingHeight, sibling->Children[g]->Height);
+            if (depth + height > maxBuildDepth)
+                continue;
+
+            auto newBounds = AABB::Union(node->Children[c]->Bounds, sibling->Children[1 - g]->Bounds);
+            float delta = (newBounds.SurfaceArea() - siblingArea) * traversalCost;
+            if (delta < bestDelta)
+            {
+                bestDelta = delta;
+                bestChild = c;
+                bestGrandchild = g;
+            }
+        }
+    }
+
+    if (bestChild < 0)
+        return false;
+
+    auto* sibling = node->Children[1 - bestChild];
+    std::swap(node->Children[bestChild], sibling->Children[bestGrandchild]);
+    sibling->Bounds = AABB::Union(sibling->Children[0]->Bounds, sibling->Children[1]->Bounds);
+    sibling->Height = 1 + std::max(sibling->Children[0]->Height, sibling->Children[1]->Height);
+    node->Height = 1 + std::max(node->Children[0]->Height, node->Children[1]->Height);
+    UpdateSplitAxis(sibling);
+    UpdateSplitAxis(node);
+    return true;
+}
+
+float BVH::ComputeBuildTreeCost(const BVHBuildNode* node) const
+{
+    float area = node->Bounds.SurfaceArea();
+    if (node->nPrimitives > 0)
+        return area * node->nPrimitives * intersectionCost;
+
+    return area * traversalCost + 
+        ComputeBuildTreeCost(node->Children[0]) + 
+        ComputeBuildTreeCost(node->Children[1]);
+}
+
 int BVH::FlattenBVHTree(BVHBuildNode* node, int* offset)
 {
     LinearBVHNode *linearNode = &m_Nodes[*offset];
@@ -232,4 +1151,255 @@ int BVH::FlattenBVHTree(BVHBuildNode* node, int* offset)
             FlattenBVHTree(node->Children[1], offset);
     }
     return myOffset;
-}
\ No newline at end of file
+}
+
+void BVH::BuildCompactNodes()
+{
+    m_CompactNodes.clear();
+    if (!m_Options.CompactNodes || m_HasMotion || m_Nodes.empty())
+        return;
+
+    // Decide where every interior node's child pair goes
+    std::vector<int> pairOrder;
+    if (m_Options.Layout == BVHNodeLayout::Clustered)
+    {
+        LayoutVEB(0, SubtreeHeight(0), pairOrder);
+    }
+    else
+    {
+        for (int i = 0; i < (int)m_Nodes.size(); i++)
+            if (m_Nodes[i].nPrimitives == 0)
+                pairOrder.push_back(i);
+    }
+
+    std::vector<int> pairOffsets(m_Nodes.size(), -1);
+    for (size_t i = 0; i < pairOrder.size(); i++)
+        pairOffsets[pairOrder[i]] = 2 + 2 * (int)i;
+
+    m_CompactNodes.resize(2 + 2 * pairOrder.size());
+    m_CompactRootBounds = m_Nodes[0].Bounds;
+    EncodeCompactNode(0, 0, m_CompactRootBounds, pairOffsets);
+}
+
+int BVH::SubtreeHeight(int nodeIndex) const
+{
+    const auto& node = m_Nodes[nodeIndex];
+    if (node.nPrimitives > 0)
+        return 0;
+    return 1 + std::max(SubtreeHeight(nodeIndex + 1), SubtreeHeight(node.SecondChildOffset));
+}
+
+void BVH::LayoutVEB(int nodeIndex, int height, std::vector<int>& pairOrder) const
+{
+    if (m_Nodes[nodeIndex].nPrimitives > 0 || height <= 0)
+        return;
+
+    if (height == 1)
+    {
+        pairOrder.push_back(nodeIndex);
+        return;
+    }
+
+    // Lay out the top half of the subtree, then each bottom subtree contiguously
+    int topHeight = height / 2;
+    LayoutVEB(nodeIndex, topHeight, pairOrder);
+
+    std::vector<int> bottomRoots;
+    CollectSubtreeRoots(nodeIndex, topHeight, bottomRoots);
+    for (int root : bottomRoots)
+        LayoutVEB(root, height - topHeight, pairOrder);
+}
+
+void BVH::CollectSubtreeRoots(int nodeIndex, int depth, std::vector<int>& roots) const
+{
+    const auto& node = m_Nodes[nodeIndex];
+    if (node.nPrimitives > 0)
+        return;
+
+    if (depth == 0)
+    {
+        roots.push_back(nodeIndex);
+        return;
+    }
+
+    CollectSubtreeRoots(nodeIndex + 1, depth - 1, roots);
+    CollectSubtreeRoots(node.SecondChildOffset, depth - 1, roots);
+}
+
+void BVH::EncodeCompactNode(int nodeIndex, int compactIndex, const AABB& decodedBounds, const std::vector<int>& pairOffsets)
+{
+    const auto& node = m_Nodes[nodeIndex];
+    auto& compact = m_CompactNodes[compactIndex];
+
+    if (node.nPrimitives > 0)
+    {
+        compact.PrimitivesOffset = node.PrimitivesOffset;
+        compact.nPrimitives = node.nPrimitives;
+        return;
+    }
+
+    int children[2] = { nodeIndex + 1, node.SecondChildOffset };
+    int pairOffset = pairOffsets[nodeIndex];
+
+    auto scale = (decodedBounds.Max - decodedBounds.Min) * (1.0f / 255.0f);
+    // Absorbs rounding differences between this encoder and the traversal
+    auto margin = (decodedBounds.Max - decodedBounds.Min) * 1e-6f;
+
+    AABB childDecoded[2];
+    uint32_t flags = 0;
+    for (int c = 0; c < 2; c++)
+    {
+        const auto& child = m_Nodes[children[c]];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float childMin = child.Bounds.Min[axis] - margin[axis];
+            float childMax = child.Bounds.Max[axis] + margin[axis];
+
+            int qMin = scale[axis] > 0.0f ? 
+                (int)std::floor((childMin - decodedBounds.Min[axis]) / scale[axis]) : 0;
+            qMin = std::clamp(qMin, 0, 255);
+            while (qMin > 0 && DecodeQuantizedMin(decodedBounds.Min[axis], scale[axis], (uint8_t)qMin) > childMin)
+                qMin--;
+
+            int qMax = scale[axis] > 0.0f ? 
+                255 - (int)std::floor((decodedBounds.Max[axis] - childMax) / scale[axis]) : 255;
+            qMax = std::clamp(qMax, 0, 255);
+            while (qMax < 255 && DecodeQuantizedMax(decodedBounds.Max[axis], scale[axis], (uint8_t)qMax) < childMax)
+                qMax++;
+
+            compact.ChildMin[c][axis] = (uint8_t)qMin;
+            compact.ChildMax[c][axis] = (uint8_t)qMax;
+            childDecoded[c].Min[axis] = DecodeQuantizedMin(decodedBounds.Min[axis], scale[axis], (uint8_t)qMin);
+            childDecoded[c].Max[axis] = DecodeQuantizedMax(decodedBounds.Max[axis], scale[axis], (uint8_t)qMax);
+        }
+
+        if (child.nPrimitives > 0)
+            flags |= c == 0 ? CompactBVHNode::LeafFlag0 : CompactBVHNode::LeafFlag1;
+    }
+
+    compact.ChildOffset = (uint32_t)pairOffset | flags | ((uint32_t)node.axis << CompactBVHNode::AxisShift);
+
+    for (int c = 0; c < 2; c++)
+        EncodeCompactNode(children[c], pairOffset + c, childDecoded[c], pairOffsets);
+}
+
+// Slab test on decoded child bounds, exiting as soon as an axis misses.
+// Boxes entered beyond tMax cannot hold a closer hit.
+static inline bool IntersectBounds(const float bmin[3], const float bmax[3], const Ray& ray, const float invDir[3], float tMax)
+{
+    float tNear = 0.0f;
+    float tFar = tMax;
+
+    for (int i = 0; i < 3; i++)
+    {
+        float t0 = (bmin[i] - ray.Origin[i]) * invDir[i];
+        float t1 = (bmax[i] - ray.Origin[i]) * invDir[i];
+        if (invDir[i] < 0.0f) std::swap(t0, t1);
+
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+        if (tFar < tNear)
+            return false;
+    }
+
+    return true;
+}
+
+template<bool countCost>
+bool BVH::IntersectCompact(const Ray& ray, float tMax, HitRecord* hit, TraversalCost* cost)
+{
+    const float invDir[3] = { 1 / ray.Direction.x, 1 / ray.Direction.y, 1 / ray.Direction.z };
+    const int dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+
+    LeafRay leafRay(ray);
+    HitRecord closest;
+    closest.T = tMax;
+    // Every child box test, the root counts as one
+    uint32_t nodesVisited = 1;
+
+    auto intersectLeaf = [&](const CompactBVHNode& leaf) {
+        IntersectLeaf<countCost>(leaf.PrimitivesOffset, leaf.nPrimitives, leafRay, closest, cost);
+    };
+
+    const float rootMin[3] = { m_CompactRootBounds.Min.x, m_CompactRootBounds.Min.y, m_CompactRootBounds.Min.z };
+    const float rootMax[3] = { m_CompactRootBounds.Max.x, m_CompactRootBounds.Max.y, m_CompactRootBounds.Max.z };
+
+    if (m_Nodes[0].nPrimitives > 0)
+    {
+        if (IntersectBounds(rootMin, rootMax, ray, invDir, closest.T))
+            intersectLeaf(m_CompactNodes[0]);
+    }
+    else if (IntersectBounds(rootMin, rootMax, ray, invDir, closest.T))
+    {
+        // Child bounds are decoded relative to the parent, so the decoded
+        // bounds travel on the stack with the node index
+        struct StackEntry
+        {
+            uint32_t NodeIndex;
+            float Min[3];
+            float Max[3];
+        };
+        StackEntry nodesToVisit[64];
+        int toVisitOffset = 0;
+        nodesToVisit[toVisitOffset].NodeIndex = 0;
+        std::copy(rootMin, rootMin + 3, nodesToVisit[toVisitOffset].Min);
+        std::copy(rootMax, rootMax + 3, nodesToVisit[toVisitOffset].Max);
+        toVisitOffset++;
+
+        const uint32_t leafFlags[2] = { CompactBVHNode::LeafFlag0, CompactBVHNode::LeafFlag1 };
+        while (toVisitOffset > 0)
+        {
+            const auto entry = nodesToVisit[--toVisitOffset];
+            const auto& node = m_CompactNodes[entry.NodeIndex];
+            const uint32_t pairOffset = node.ChildOffset & CompactBVHNode::OffsetMask;
+            // The first child holds the lower side of the split
+            const int nearChild = dirIsNeg[(node.ChildOffset & CompactBVHNode::AxisMask) >> CompactBVHNode::AxisShift];
+
+            float scale[3];
+            for (int axis = 0; axis < 3; axis++)
+                scale[axis] = (entry.Max[axis] - entry.Min[axis]) * (1.0f / 255.0f);
+
+            // Near child first. Leaves are intersected right away, so a hit in
+            // the near leaf already clips the far box. Interior children are
+            // pushed far first, the near one is popped next.
+            bool pushNear = false;
+            StackEntry nearEntry;
+            for (int i = 0; i < 2; i++)
+            {
+                const int c = i ^ nearChild;
+                StackEntry child;
+                child.NodeIndex = pairOffset + c;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    child.Min[axis] = DecodeQuantizedMin(entry.Min[axis], scale[axis], node.ChildMin[c][axis]);
+                    child.Max[axis] = DecodeQuantizedMax(entry.Max[axis], scale[axis], node.ChildMax[c][axis]);
+                }
+                nodesVisited++;
+                if (!IntersectBounds(child.Min, child.Max, ray, invDir, closest.T))
+                    continue;
+
+                if (node.ChildOffset & leafFlags[c])
+                    intersectLeaf(m_CompactNodes[child.NodeIndex]);
+                else if (i == 0)
+                {
+                    pushNear = true;
+                    nearEntry = child;
+                }
+                else
+                    nodesToVisit[toVisitOffset++] = child;
+            }
+            if (pushNear)
+                nodesToVisit[toVisitOffset++] = nearEntry;
+        }
+    }
+
+    RENDER_STAT_ADD(NodesVisited, nodesVisited);
+    if constexpr (countCost)
+        cost->NodesVisited += nodesVisited;
+
+    if (closest.T == tMax)
+        return false;
+
+    *hit = closest;
+    return true;
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "Primitive.h"
+#include "core/AlignedAllocator.h"
 #include <functional>
 #include <memory>
+#include <variant>
 
 struct BVHPrimitiveInfo
 {
@@ -23,6 +25,7 @@ struct BVHBuildNode
         nPrimitives = n;
         Bounds = b;
         Children[0] = Children[1] = nullptr;
+        Height = 0;
     }
     void InitInterior(int axis, BVHBuildNode *c0, BVHBuildNode *c1) {
         Children[0] = c0;
@@ -30,10 +33,13 @@ struct BVHBuildNode
         Bounds = AABB::Union(c0->Bounds, c1->Bounds);
         SplitAxis = axis;
         nPrimitives = 0;
+        Height = 1 + std::max(c0->Height, c1->Height);
     }
     AABB Bounds;
     BVHBuildNode* Children[2];
     int SplitAxis, FirstPrimOffset, nPrimitives;
+    // Levels below this node, leaves are 0
+    int Height;
 };
 
 
@@ -63,6 +69,51 @@ private:
     size_t m_Size = 0;
 };
 
+enum class BVHSplitMethod
+{
+    EqualCounts,    // median split along the largest centroid extent
+    SAH,            // binned surface area heuristic over object partitions
+    SBVH            // SAH that also considers spatial splits which clip primitive references
+};
+
+enum class BVHNodeLayout
+{
+    DepthFirst,     // child pairs in pre-order
+    Clustered       // van Emde Boas order, subtrees are recursively kept contiguous
+};
+
+struct BVHBuildOptions
+{
+    BVHSplitMethod SplitMethod = BVHSplitMethod::EqualCounts;
+    int MaxPrimsInLeaf = 4;
+    // Spatial splits are only tried where the best object split children
+    // overlap by more than this fraction of the root surface area
+    float SpatialSplitAlpha = 1e-5f;
+    // Maximum number of duplicated references, relative to the primitive count
+    float DuplicationBudget = 0.5f;
+    // Post-build tree rotations that lower the SAH cost before flattening
+    bool OptimizeTree = false;
+    // Upper bound on rotation passes, the tree does not depend on machine speed
+    int OptimizeMaxPasses = 16;
+    // Optional wall clock limit, checked between passes. 0 means unlimited,
+    // any other value makes the tree depend on machine speed.
+    float OptimizeTimeBudgetMs = 0.0f;
+    // Traverse 16-byte nodes with 8-bit child bounds instead of LinearBVHNode,
+    // not used while primitives are animated
+    bool CompactNodes = false;
+    BVHNodeLayout Layout = BVHNodeLayout::DepthFirst;
+};
+
+struct BVHSplit
+{
+    float Cost = std::numeric_limits<float>::max();
+    int Axis = -1;
+    int Bin = 0;
+    float Position = 0.0f;
+    AABB LeftBounds, RightBounds;
+    int LeftCount = 0, RightCount = 0;
+};
+
 struct LinearBVHNode 
 {
     AABB Bounds;
@@ -76,29 +127,226 @@ struct LinearBVHNode
     uint8_t pad[1];
 };
 
+// Interior nodes store both child bounds quantized to 8 bits inside their own
+// (decoded) bounds. Children are stored as a pair at ChildOffset and
+// ChildOffset + 1, the top bits of ChildOffset flag the children that are
+// leaves and hold the split axis for front-to-back order, and leaf entries
+// reuse the node storage for the primitive range.
+struct alignas(16) CompactBVHNode
+{
+    union
+    {
+        struct
+        {
+            uint8_t ChildMin[2][3];
+            uint8_t ChildMax[2][3];
+            uint32_t ChildOffset;
+        };
+        struct
+        {
+            int PrimitivesOffset;
+            int nPrimitives;
+        };
+    };
+
+    static constexpr uint32_t LeafFlag0 = 0x80000000u;
+    static constexpr uint32_t LeafFlag1 = 0x40000000u;
+    static constexpr uint32_t AxisShift = 28;
+    static constexpr uint32_t AxisMask = 0x30000000u;
+    static constexpr uint32_t OffsetMask = 0x0FFFFFFFu;
+};
+static_assert(sizeof(CompactBVHNode) == 16, "CompactBVHNode must stay 16 bytes");
+
+// Decoding is exact at q == 0 for the minimum and q == 255 for the maximum,
+// so child bounds stay inside the parent regardless of rounding
+inline float DecodeQuantizedMin(float parentMin, float scale, uint8_t q)
+{
+    return parentMin + q * scale;
+}
+
+inline float DecodeQuantizedMax(float parentMax, float scale, uint8_t q)
+{
+    return parentMax - (255 - q) * scale;
+}
+
+// World space copies of static primitives, the leaf kernels intersect these
+// directly instead of moving every ray into object space
+struct WorldTriangle
+{
+    // Vertices rather than edges, the watertight test needs the exact
+    // positions shared with neighbouring triangles
+    glm::vec3 P0, P1, P2;
+};
+
+struct WorldSphere
+{
+    glm::vec3 Center;
+    float Radius;
+};
+
+struct WorldQuad
+{
+    glm::vec3 Center;
+    glm::vec3 Normal;
+    // Scaled so dot(p - Center, Axis) is the object space coordinate
+    glm::vec3 UAxis, VAxis;
+    float HalfWidth, HalfHeight;
+};
+
+// Quads are larger than triangles and rare, their records live in a side
+// array so the triangle sets the size of every leaf record
+struct LeafQuad
+{
+    uint32_t Index;
+};
+
+// Animated and non-uniformly scaled primitives keep the object space test.
+// The primitive is the m_Primitives entry at the same index.
+struct TransformedPrimitive
+{
+};
+
+// Mirrors m_Primitives. References of a leaf are sorted by shape, so a leaf is
+// a few runs of one alternative each. Shading data stays with the primitive.
+struct LeafPrimitive
+{
+    std::variant<WorldTriangle, WorldSphere, LeafQuad, TransformedPrimitive> Geometry;
+    // shapeTMin scaled to world space
+    float TMin = 0.0f;
+};
+static_assert(sizeof(LeafPrimitive) <= sizeof(WorldTriangle) + 2 * sizeof(float), "Triangles must set the leaf record size");
+
+// Ray with the per-ray setup of the leaf kernels, made once per traversal
+struct LeafRay : Ray
+{
+    explicit LeafRay(const Ray& ray)
+        : Ray(ray), InvDirLength(1.0f / glm::length(ray.Direction)), Shear(ray.Direction) {}
+
+    float InvDirLength;
+    RayShear Shear;
+};
+
+// Work of a single traversal, for the traversal cost heatmap
+struct TraversalCost
+{
+    uint32_t NodesVisited = 0;
+    uint32_t PrimitiveTests = 0;
+};
+
 class BVH : Primitive
 {
 public:
-    BVH(std::vector<std::shared_ptr<SimplePrimitive>> primitives);
+    BVH(std::vector<std::shared_ptr<SimplePrimitive>> primitives, const BVHBuildOptions& options = BVHBuildOptions());
+
+    const BVHBuildOptions& GetOptions() const   { return m_Options; }
+    // Total primitive references in the leaves, larger than the primitive count with spatial splits
+    size_t GetReferenceCount() const            { return m_Primitives.size(); }
 
     virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) override;
+    // Same result as Intersect, also adds the nodes and primitive tests the
+    // ray took to cost
+    void IntersectWithCost(const Ray& ray, SurfaceInteraction* intersect, TraversalCost& cost);
+
+    // Closest hit before tMax only, hit->PrimitiveIndex is the leaf reference.
+    // Intersect is IntersectHit followed by ComputeInteraction.
+    bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit);
+    void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect);
 
     void Traverse(std::function<void(int /* depth */, const AABB& aabb)>);
 
+    // Recompute node bounds bottom-up after primitive transforms have changed.
+    // Falls back to a full rebuild once the SAH cost has degraded past the
+    // rebuild threshold. Returns true if the tree was rebuilt.
+    // Must not be called while another thread is intersecting the BVH.
+    bool Refit();
+
+    // SAH cost of the current tree, normalized by the root surface area
+    float ComputeSAHCost() const;
+
+    void SetRebuildThreshold(float threshold)   { m_RebuildThreshold = threshold; }
+    float GetRebuildThreshold() const           { return m_RebuildThreshold; }
+
 private:
 
+    void Build();
+
+    void RefitNodes();
+    void RefitSubtree(int nodeIndex);
+    void CollectRefitTasks(int nodeIndex, int depth, std::vector<int>& topNodes, std::vector<int>& taskRoots) const;
+
     BVHBuildNode* RecursiveBuild(
         BVHBuildNodePool& nodePool,
         std::vector<BVHPrimitiveInfo>& primitiveInfo, 
         int start, 
         int end, 
+        int depth,
         int *totalNodes,
         std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
     );
 
+    BVHBuildNode* RecursiveBuildSpatial(
+        BVHBuildNodePool& nodePool,
+        std::vector<BVHPrimitiveInfo>& references,
+        int depth,
+        float rootArea,
+        int *totalNodes,
+        int *duplicationBudget,
+        std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
+    );
+
+    BVHSplit FindObjectSplit(const BVHPrimitiveInfo* references, int count, const AABB& centroidBounds) const;
+    BVHSplit FindSpatialSplit(const std::vector<BVHPrimitiveInfo>& references, const AABB& bounds) const;
+
+    BVHBuildNode* MakeLeaf(
+        BVHBuildNode* node,
+        const BVHPrimitiveInfo* references,
+        int count,
+        const AABB& bounds,
+        std::vector<std::shared_ptr<SimplePrimitive>>& orderedPrims
+    );
+
+    void OptimizeTree(BVHBuildNode* root);
+    bool RotatePass(BVHBuildNode* node, int depth);
+    bool TryRotate(BVHBuildNode* node, int depth);
+    float ComputeBuildTreeCost(const BVHBuildNode* node) const;
+
     int FlattenBVHTree(BVHBuildNode* node, int* offset);
 
-    std::vector<LinearBVHNode> m_Nodes;
+    void BuildCompactNodes();
+    void LayoutVEB(int nodeIndex, int height, std::vector<int>& pairOrder) const;
+    void CollectSubtreeRoots(int nodeIndex, int depth, std::vector<int>& roots) const;
+    int SubtreeHeight(int nodeIndex) const;
+    void EncodeCompactNode(int nodeIndex, int compactIndex, const AABB& decodedBounds, const std::vector<int>& pairOffsets);
+    void SortLeavesByShape();
+    void BuildLeafPrimitives();
+    template<bool countCost>
+    void IntersectLeaf(int offset, int count, const LeafRay& ray, HitRecord& hit, TraversalCost* cost) const;
+
+    // The counting variants are separate instantiations, the plain
+    // traversal does not carry the cost
+    template<bool countCost>
+    bool IntersectLinear(const Ray& ray, float tMax, HitRecord* hit, TraversalCost* cost);
+    template<bool countCost>
+    bool IntersectCompact(const Ray& ray, float tMax, HitRecord* hit, TraversalCost* cost);
+
+    std::vector<LinearBVHNode, AlignedAllocator<LinearBVHNode, CacheLineSize>> m_Nodes;
+    // Entry 0 is the root, child pairs start at entry 2 so a pair never
+    // straddles a cache line
+    std::vector<CompactBVHNode, AlignedAllocator<CompactBVHNode, CacheLineSize>> m_CompactNodes;
+    AABB m_CompactRootBounds;
+    // Node bounds at shutter close when any primitive is animated, the node
+    // Bounds then hold the bounds at shutter open
+    std::vector<AABB> m_MotionBounds;
+    bool m_HasMotion = false;
+    // Primitive references in leaf order, primitives may appear more than once
     std::vector<std::shared_ptr<SimplePrimitive>> m_Primitives;
-    
+    std::vector<LeafPrimitive> m_LeafPrimitives;
+    std::vector<WorldQuad> m_LeafQuads;
+    // Unique primitives the tree is (re)built from
+    std::vector<std::shared_ptr<SimplePrimitive>> m_BuildPrimitives;
+
+    BVHBuildOptions m_Options;
+    float m_BuildSAHCost = 0.0f;
+    float m_RebuildThreshold = 1.5f;
+
 };
\ No newline at end of file
@@ -2,11 +2,18 @@
 
 #include "Geometry.h"
 
+enum class CameraProjection
+{
+    Perspective,    // thin lens when the aperture is not zero
+    Orthographic,
+    Environment     // equirectangular, covers the full sphere around the camera
+};
+
 class Camera
 {
 public:
-    Camera(const glm::vec3& position, const glm::vec3& front, float width, float height, float focal=1.0f)
-        : m_Position(position), m_Width(width), m_Height(height), m_Focal(focal)
+    Camera(const glm::vec3& position, const glm::vec3& front, float width, float height, float focusDistance=1.0f)
+        : m_Position(position), m_Width(width), m_Height(height), m_FocusDistance(focusDistance)
     {
         m_Front = glm::normalize(front);
         m_Right = glm::normalize(glm::cross(m_Front, m_YAxis));
@@ -40,6 +47,7 @@ public:
         {
             float smoothedZoom = m_ZoomVelocity * deltaTime * m_Smoothness;
             m_Position += m_Front * smoothedZoom;
+            m_Version++;
             if (m_EnableSmoothing)
                 m_ZoomVelocity *= std::exp(-m_Smoothness * deltaTime);
             else
@@ -51,6 +59,7 @@ public:
         {
             glm::vec2 smoothedTranslation = m_TranslationVelocity * deltaTime * m_Smoothness;
             m_Position += m_Right * smoothedTranslation.x + m_Up * smoothedTranslation.y;
+            m_Version++;
             if(m_EnableSmoothing)
                 m_TranslationVelocity *= std::exp(-m_Smoothness * deltaTime);
             else
@@ -71,6 +80,7 @@ public:
 
             m_Right = glm::normalize(glm::cross(m_Front, m_YAxis));
             m_Up = glm::normalize(glm::cross(m_Right, m_Front));
+            m_Version++;
 
             if (m_EnableSmoothing)
                 m_RotationVelocity *= std::exp(-m_Smoothness * deltaTime);
@@ -83,25 +93,49 @@ public:
     {
         glm::mat4 view = glm::lookAtRH(m_Position, m_Position + m_Front, m_Up);
         // Fron right-handed to left-handed, depth range is in [0.0, 1.0f]
-        glm::mat4 proj = glm::perspectiveRH_ZO(1.0f, m_Width / m_Height, 0.01f, 1000.0f);
+        glm::mat4 proj = glm::perspectiveRH_ZO(m_FovY, m_Width / m_Height, 0.01f, 1000.0f);
+        if (m_Projection == CameraProjection::Orthographic)
+        {
+            float halfHeight = 0.5f * m_OrthographicHeight;
+            float halfWidth = halfHeight * m_Width / m_Height;
+            proj = glm::orthoRH_ZO(-halfWidth, halfWidth, -halfHeight, halfHeight, 0.01f, 1000.0f);
+        }
         return proj * view;
     }
 
+    void SetProjection(CameraProjection projection) { m_Projection = projection; m_Version++; }
+    // Vertical field of view in radians
+    void SetFovY(float fovY) { m_FovY = fovY; m_Version++; }
+    // Lens diameter in world units, 0 is a pinhole
+    void SetAperture(float aperture) { m_Aperture = aperture; m_Version++; }
+    void SetFocusDistance(float distance) { m_FocusDistance = distance; m_Version++; }
+    // Height of the view volume in world units
+    void SetOrthographicHeight(float height) { m_OrthographicHeight = height; m_Version++; }
+
     glm::vec3 GetPosition() const { return m_Position; }
     glm::vec3 GetViewDir() const { return m_Front; }
+    glm::vec3 GetRight() const { return m_Right; }
+    glm::vec3 GetUp() const { return m_Up; }
+    CameraProjection GetProjection() const { return m_Projection; }
+    float GetFovY() const { return m_FovY; }
+    float GetAperture() const { return m_Aperture; }
+    float GetFocusDistance() const { return m_FocusDistance; }
+    float GetOrthographicHeight() const { return m_OrthographicHeight; }
+    // Incremented on every change that affects the generated rays
+    uint32_t GetVersion() const { return m_Version; }
     float GetWidth() const { return m_Width; }
     float GetHeight() const { return m_Height; }
     float GetAspectRatio() const { return m_Height / m_Width; }
-    float GetFocal() const { return m_Focal; }
 
+    // Pinhole perspective ray, the renderer generates rays with
+    // CameraRayGenerator which also handles the lens and other projections
     Ray GetCameraRay(float px, float py) const 
     {
         // Normalize pixel coordinates to [-1, 1]
         float ndcX = (px / m_Width) * 2.0f - 1.0f;
         float ndcY = 1.0f - (py / m_Height) * 2.0f; // Flip Y
 
-        // Assume vertical FoV of 1 radian for simplicity
-        float tanFovY = tan(0.5f); // or adjust based on your real FoV
+        float tanFovY = tan(0.5f * GetFovY());
         float aspect = m_Width / m_Height;
 
         glm::vec3 rayDirCameraSpace = glm::normalize(glm::vec3(
@@ -133,7 +167,13 @@ private:
 
     float m_Width;
     float m_Height;
-    float m_Focal;
+
+    CameraProjection m_Projection = CameraProjection::Perspective;
+    float m_FovY = 1.0f;
+    float m_Aperture = 0.0f;
+    float m_FocusDistance;
+    float m_OrthographicHeight = 10.0f;
+    uint32_t m_Version = 0;
 
     bool m_EnableSmoothing = false;
     float m_ZoomVelocity = 0.0f;
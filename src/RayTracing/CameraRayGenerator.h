@@ -0,0 +1,248 @@
+#pragma once
+
+#include "Camera.h"
+#include "Math.h"
+#include <cmath>
+
+// Primary rays of one tile in SoA layout. FilmX/FilmY/Time/LensU/LensV are
+// filled by the caller from the sampler, GenerateRays fills the origins and
+// directions.
+struct CameraRayBatch
+{
+    // Largest tile of the renderer, 16x16
+    constexpr static int capacity = 256;
+
+    int Count = 0;
+    alignas(32) float FilmX[capacity];
+    alignas(32) float FilmY[capacity];
+    alignas(32) float Time[capacity];
+    alignas(32) float LensU[capacity];
+    alignas(32) float LensV[capacity];
+    alignas(32) float OriginX[capacity];
+    alignas(32) float OriginY[capacity];
+    alignas(32) float OriginZ[capacity];
+    alignas(32) float DirX[capacity];
+    alignas(32) float DirY[capacity];
+    alignas(32) float DirZ[capacity];
+
+    Ray GetRay(int index) const
+    {
+        Ray ray;
+        ray.Origin = { OriginX[index], OriginY[index], OriginZ[index] };
+        ray.Direction = { DirX[index], DirY[index], DirZ[index] };
+        ray.Time = Time[index];
+        return ray;
+    }
+};
+
+// Perspective and orthographic rays are linear in the film position
+// (px, py): Base + px * DX + py * DY gives the pinhole direction respectively
+// the orthographic origin. The basis is only rebuilt when the camera changes,
+// between passes of a static camera generating a ray is a few multiply-adds
+// and a normalization.
+class CameraRayGenerator
+{
+public:
+    // Returns true when the camera changed since the last call
+    bool Update(const Camera& camera)
+    {
+        if (m_Camera == &camera && m_Version == camera.GetVersion())
+            return false;
+
+        m_Camera = &camera;
+        m_Version = camera.GetVersion();
+        m_Projection = camera.GetProjection();
+        m_Position = camera.GetPosition();
+        m_Front = camera.GetViewDir();
+        m_Right = camera.GetRight();
+        m_Up = camera.GetUp();
+        m_LensRadius = 0.5f * camera.GetAperture();
+        m_FocusDistance = camera.GetFocusDistance();
+
+        float width = camera.GetWidth();
+        float height = camera.GetHeight();
+        float aspect = width / height;
+
+        switch (m_Projection)
+        {
+        case CameraProjection::Perspective:
+        {
+            // The Front component of the direction is 1, so scaling it by the
+            // focus distance lands on the plane of focus
+            float tanFovY = std::tan(0.5f * camera.GetFovY());
+            m_Base = m_Front - aspect * tanFovY * m_Right + tanFovY * m_Up;
+            m_DX = (2.0f * aspect * tanFovY / width) * m_Right;
+            m_DY = (-2.0f * tanFovY / height) * m_Up;
+            break;
+        }
+        case CameraProjection::Orthographic:
+        {
+            float halfHeight = 0.5f * camera.GetOrthographicHeight();
+            float halfWidth = halfHeight * aspect;
+            m_Base = m_Position - halfWidth * m_Right + halfHeight * m_Up;
+            m_DX = (2.0f * halfWidth / width) * m_Right;
+            m_DY = (-2.0f * halfHeight / height) * m_Up;
+            break;
+        }
+        case CameraProjection::Environment:
+        {
+            constexpr float pi = 3.14159265359f;
+            m_PhiScale = 2.0f * pi / width;
+            m_ThetaScale = pi / height;
+            break;
+        }
+        }
+
+        return true;
+    }
+
+    void GenerateRays(CameraRayBatch& batch) const
+    {
+        switch (m_Projection)
+        {
+        case CameraProjection::Perspective:
+            if (m_LensRadius > 0.0f)
+                GenerateThinLens(batch);
+            else
+                GeneratePinhole(batch);
+            break;
+        case CameraProjection::Orthographic:
+            GenerateOrthographic(batch);
+            break;
+        case CameraProjection::Environment:
+            GenerateEnvironment(batch);
+            break;
+        }
+    }
+
+private:
+    // The loops below only touch the SoA arrays so the compiler vectorizes them
+
+    void GeneratePinhole(CameraRayBatch& batch) const
+    {
+        const int count = batch.Count;
+        const float baseX = m_Base.x, baseY = m_Base.y, baseZ = m_Base.z;
+        const float dxX = m_DX.x, dxY = m_DX.y, dxZ = m_DX.z;
+        const float dyX = m_DY.x, dyY = m_DY.y, dyZ = m_DY.z;
+
+        for (int k = 0; k < count; k++)
+        {
+            float px = batch.FilmX[k];
+            float py = batch.FilmY[k];
+            float x = baseX + px * dxX + py * dyX;
+            float y = baseY + px * dxY + py * dyY;
+            float z = baseZ + px * dxZ + py * dyZ;
+            float invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+            batch.DirX[k] = x * invLength;
+            batch.DirY[k] = y * invLength;
+            batch.DirZ[k] = z * invLength;
+        }
+
+        FillOrigins(batch);
+    }
+
+    // Rays start on the lens disk and pass through the point where the
+    // pinhole ray meets the plane of focus
+    void GenerateThinLens(CameraRayBatch& batch) const
+    {
+        const int count = batch.Count;
+        const float baseX = m_Base.x, baseY = m_Base.y, baseZ = m_Base.z;
+        const float dxX = m_DX.x, dxY = m_DX.y, dxZ = m_DX.z;
+        const float dyX = m_DY.x, dyY = m_DY.y, dyZ = m_DY.z;
+        const float rightX = m_Right.x * m_LensRadius, rightY = m_Right.y * m_LensRadius, rightZ = m_Right.z * m_LensRadius;
+        const float upX = m_Up.x * m_LensRadius, upY = m_Up.y * m_LensRadius, upZ = m_Up.z * m_LensRadius;
+        const float focusDistance = m_FocusDistance;
+
+        for (int k = 0; k < count; k++)
+        {
+            float px = batch.FilmX[k];
+            float py = batch.FilmY[k];
+            float lensX, lensY;
+            SampleUniformDiskConcentric(batch.LensU[k], batch.LensV[k], lensX, lensY);
+
+            float offsetX = lensX * rightX + lensY * upX;
+            float offsetY = lensX * rightY + lensY * upY;
+            float offsetZ = lensX * rightZ + lensY * upZ;
+
+            float x = (baseX + px * dxX + py * dyX) * focusDistance - offsetX;
+            float y = (baseY + px * dxY + py * dyY) * focusDistance - offsetY;
+            float z = (baseZ + px * dxZ + py * dyZ) * focusDistance - offsetZ;
+            float invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+            batch.DirX[k] = x * invLength;
+            batch.DirY[k] = y * invLength;
+            batch.DirZ[k] = z * invLength;
+
+            batch.OriginX[k] = m_Position.x + offsetX;
+            batch.OriginY[k] = m_Position.y + offsetY;
+            batch.OriginZ[k] = m_Position.z + offsetZ;
+        }
+    }
+
+    void GenerateOrthographic(CameraRayBatch& batch) const
+    {
+        const int count = batch.Count;
+        const float baseX = m_Base.x, baseY = m_Base.y, baseZ = m_Base.z;
+        const float dxX = m_DX.x, dxY = m_DX.y, dxZ = m_DX.z;
+        const float dyX = m_DY.x, dyY = m_DY.y, dyZ = m_DY.z;
+
+        for (int k = 0; k < count; k++)
+        {
+            float px = batch.FilmX[k];
+            float py = batch.FilmY[k];
+            batch.OriginX[k] = baseX + px * dxX + py * dyX;
+            batch.OriginY[k] = baseY + px * dxY + py * dyY;
+            batch.OriginZ[k] = baseZ + px * dxZ + py * dyZ;
+            batch.DirX[k] = m_Front.x;
+            batch.DirY[k] = m_Front.y;
+            batch.DirZ[k] = m_Front.z;
+        }
+    }
+
+    // Equirectangular: the image centre looks along Front, the top row along Up
+    void GenerateEnvironment(CameraRayBatch& batch) const
+    {
+        const int count = batch.Count;
+
+        for (int k = 0; k < count; k++)
+        {
+            float phi = batch.FilmX[k] * m_PhiScale;
+            float theta = batch.FilmY[k] * m_ThetaScale;
+            float sinTheta = std::sin(theta);
+            float frontWeight = -sinTheta * std::cos(phi);
+            float rightWeight = -sinTheta * std::sin(phi);
+            float upWeight = std::cos(theta);
+            batch.DirX[k] = frontWeight * m_Front.x + rightWeight * m_Right.x + upWeight * m_Up.x;
+            batch.DirY[k] = frontWeight * m_Front.y + rightWeight * m_Right.y + upWeight * m_Up.y;
+            batch.DirZ[k] = frontWeight * m_Front.z + rightWeight * m_Right.z + upWeight * m_Up.z;
+        }
+
+        FillOrigins(batch);
+    }
+
+    void FillOrigins(CameraRayBatch& batch) const
+    {
+        for (int k = 0; k < batch.Count; k++)
+        {
+            batch.OriginX[k] = m_Position.x;
+            batch.OriginY[k] = m_Position.y;
+            batch.OriginZ[k] = m_Position.z;
+        }
+    }
+
+    const Camera* m_Camera = nullptr;
+    uint32_t m_Version = 0;
+
+    CameraProjection m_Projection = CameraProjection::Perspective;
+    glm::vec3 m_Position{ 0.0f };
+    glm::vec3 m_Front{ 0.0f };
+    glm::vec3 m_Right{ 0.0f };
+    glm::vec3 m_Up{ 0.0f };
+    float m_LensRadius = 0.0f;
+    float m_FocusDistance = 1.0f;
+
+    glm::vec3 m_Base{ 0.0f };
+    glm::vec3 m_DX{ 0.0f };
+    glm::vec3 m_DY{ 0.0f };
+    float m_PhiScale = 0.0f;
+    float m_ThetaScale = 0.0f;
+};
@@ -0,0 +1,306 @@
+#include "Denoiser.h"
+#include "core/Trace.h"
+#include <cmath>
+#include <cstring>
+
+// SSE2 is part of every x64 target, other targets use the scalar loop only
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DENOISER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Keeps the division by the albedo finite for black materials
+constexpr static float minAlbedo = 1e-3f;
+// Luminance offset of the relative color distance, avoids blowing up the
+// distance of very dark pixels
+constexpr static float luminanceEpsilon = 1e-2f;
+constexpr static float kernelWeights[3] = { 0.25f, 0.5f, 0.25f };
+// Rows per pool task, small enough to balance the passes over the threads
+constexpr static uint32_t rowsPerTask = 8;
+// Color and weight sums, color and depth scales of a row
+constexpr static int filterScratchRows = 6;
+
+// Edge weights below e^-87 are flushed to about 1e-38, keeps the exponent
+// of the scale factor in the normal range
+constexpr static float minExponent = -87.0f;
+constexpr static float log2e = 1.44269504f;
+// Taylor series of 2^f for |f| <= 0.5, relative error below 3e-6
+constexpr static float exp2Coefficients[6] = { 1.0f, 0.693147181f, 0.240226507f, 0.0555041087f, 0.00961812911f, 0.00133335581f };
+
+static float Luminance(float r, float g, float b)
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// exp(x) for x <= 0 as 2^round(t) * 2^(t - round(t)), t = x * log2(e). The
+// SSE2 kernel evaluates the same steps, so every pixel of a row gets the
+// same weights whether it ends up in a vector or in the scalar tail.
+static float ExpNonPositive(float x)
+{
+    x = x > minExponent ? x : minExponent;
+    float t = x * log2e;
+    float i = std::nearbyint(t);
+    float f = t - i;
+    float p = exp2Coefficients[5];
+    for (int k = 4; k >= 0; k--)
+        p = p * f + exp2Coefficients[k];
+
+    int32_t bits = ((int32_t)i + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+#ifdef DENOISER_SSE2
+static __m128 ExpNonPositive(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(minExponent));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(log2e));
+    // Rounds to nearest like std::nearbyint in the default rounding mode
+    __m128i i = _mm_cvtps_epi32(t);
+    __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+    __m128 p = _mm_set1_ps(exp2Coefficients[5]);
+    for (int k = 4; k >= 0; k--)
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(exp2Coefficients[k]));
+
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+
+static __m128 Abs(__m128 x)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+#endif
+
+template<typename Func>
+void Denoiser::ParallelRows(Func func)
+{
+    uint32_t taskCount = (m_Height + rowsPerTask - 1) / rowsPerTask;
+    m_Workers->ParallelFor(taskCount, [&](uint32_t task, uint32_t worker) {
+        TRACE_SCOPE("Denoise rows");
+        uint32_t y0 = task * rowsPerTask;
+        func(y0, std::min(y0 + rowsPerTask, m_Height), worker);
+    });
+}
+
+void Denoiser::Denoise(const Film& film)
+{
+    TRACE_SCOPE("Denoise");
+    if (!m_Workers)
+        m_Workers = std::make_unique<WorkerPool>("Denoise worker");
+
+    if (m_Width != film.GetWidth() || m_Height != film.GetHeight())
+    {
+        m_Width = film.GetWidth();
+        m_Height = film.GetHeight();
+        size_t pixelCount = (size_t)m_Width * m_Height;
+        for (int c = 0; c < 3; c++)
+        {
+            m_Albedo[c].resize(pixelCount);
+            m_Normal[c].resize(pixelCount);
+            m_Irradiance[c].resize(pixelCount);
+            m_Filtered[c].resize(pixelCount);
+            m_Output[c].resize(pixelCount);
+        }
+        m_Depth.resize(pixelCount);
+        m_SampleCount.resize(pixelCount);
+        m_Luminance.resize(pixelCount);
+        m_FilteredLuminance.resize(pixelCount);
+        m_FilterScratch.assign(m_Workers->GetThreadCount(), std::vector<float>(filterScratchRows * (size_t)m_Width));
+    }
+
+    ParallelRows([&](uint32_t y0, uint32_t y1, uint32_t) { GatherGuides(film, y0, y1); });
+
+    float colorSigma = m_Settings.ColorSigma;
+    for (int iteration = 0; iteration < m_Settings.Iterations; iteration++)
+    {
+        int step = 1 << iteration;
+        ParallelRows([&](uint32_t y0, uint32_t y1, uint32_t worker) {
+            FilterRows(step, colorSigma, y0, y1, m_FilterScratch[worker].data());
+        });
+        for (int c = 0; c < 3; c++)
+            std::swap(m_Irradiance[c], m_Filtered[c]);
+        std::swap(m_Luminance, m_FilteredLuminance);
+        colorSigma *= 0.5f;
+    }
+
+    ParallelRows([&](uint32_t y0, uint32_t y1, uint32_t) { Remodulate(y0, y1); });
+}
+
+void Denoiser::GatherGuides(const Film& film, uint32_t y0, uint32_t y1)
+{
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        size_t row = (size_t)y * m_Width;
+        FilmRowPlanes planes = {
+            { &m_Irradiance[0][row], &m_Irradiance[1][row], &m_Irradiance[2][row] },
+            { &m_Albedo[0][row], &m_Albedo[1][row], &m_Albedo[2][row] },
+            { &m_Normal[0][row], &m_Normal[1][row], &m_Normal[2][row] },
+            &m_Depth[row],
+            &m_SampleCount[row]
+        };
+        film.ResolveRow(y, planes);
+
+        for (int c = 0; c < 3; c++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+                m_Irradiance[c][row + x] /= std::max(m_Albedo[c][row + x], minAlbedo);
+        }
+        for (uint32_t x = 0; x < m_Width; x++)
+        {
+            m_SampleCount[row + x] = std::max(m_SampleCount[row + x], 1.0f);
+            m_Luminance[row + x] = Luminance(m_Irradiance[0][row + x], m_Irradiance[1][row + x], m_Irradiance[2][row + x]);
+        }
+    }
+}
+
+void Denoiser::FilterRows(int step, float colorSigma, uint32_t y0, uint32_t y1, float* scratch)
+{
+    const int width = (int)m_Width;
+    const int height = (int)m_Height;
+    const float invColorSigma2 = 1.0f / (colorSigma * colorSigma);
+    const float invDepthSigma = 1.0f / (m_Settings.DepthSigma * step);
+    const float invAlbedoSigma = 1.0f / m_Settings.AlbedoSigma;
+    const int normalSharpness = m_Settings.NormalSharpness;
+
+    float* sumR = scratch;
+    float* sumG = sumR + width;
+    float* sumB = sumG + width;
+    float* sumW = sumB + width;
+    // The parts of the color and depth distances that only depend on the
+    // centre pixel, keeps the divisions out of the tap loops
+    float* colorScale = sumW + width;
+    float* depthScale = colorScale + width;
+
+    for (int y = (int)y0; y < (int)y1; y++)
+    {
+        const size_t rowP = (size_t)y * width;
+        const float* lumP = &m_Luminance[rowP];
+        const float* depthP = &m_Depth[rowP];
+        const float* countP = &m_SampleCount[rowP];
+        const float* nxP = &m_Normal[0][rowP];
+        const float* nyP = &m_Normal[1][rowP];
+        const float* nzP = &m_Normal[2][rowP];
+        const float* arP = &m_Albedo[0][rowP];
+        const float* agP = &m_Albedo[1][rowP];
+        const float* abP = &m_Albedo[2][rowP];
+
+        // The centre tap always has full edge weight
+        const float centerWeight = kernelWeights[1] * kernelWeights[1];
+        for (int x = 0; x < width; x++)
+        {
+            sumR[x] = centerWeight * m_Irradiance[0][rowP + x];
+            sumG[x] = centerWeight * m_Irradiance[1][rowP + x];
+            sumB[x] = centerWeight * m_Irradiance[2][rowP + x];
+            sumW[x] = centerWeight;
+            colorScale[x] = invColorSigma2 * countP[x] / (lumP[x] * lumP[x] + luminanceEpsilon);
+            depthScale[x] = invDepthSigma / (depthP[x] + 1e-3f);
+        }
+
+        for (int ty = -1; ty <= 1; ty++)
+        {
+            int yq = y + ty * step;
+            if (yq < 0 || yq >= height)
+                continue;
+
+            for (int tx = -1; tx <= 1; tx++)
+            {
+                if (tx == 0 && ty == 0)
+                    continue;
+
+                // Taps outside the image are dropped, so only the x range
+                // with an in-bounds neighbour is visited
+                const int dx = tx * step;
+                const int xBegin = std::max(0, -dx);
+                const int xEnd = std::min(width, width - dx);
+                const float h = kernelWeights[tx + 1] * kernelWeights[ty + 1];
+
+                const size_t rowQ = (size_t)yq * width;
+                const float* lumQ = &m_Luminance[rowQ];
+                const float* depthQ = &m_Depth[rowQ];
+                const float* nxQ = &m_Normal[0][rowQ];
+                const float* nyQ = &m_Normal[1][rowQ];
+                const float* nzQ = &m_Normal[2][rowQ];
+                const float* arQ = &m_Albedo[0][rowQ];
+                const float* agQ = &m_Albedo[1][rowQ];
+                const float* abQ = &m_Albedo[2][rowQ];
+                const float* rQ = &m_Irradiance[0][rowQ];
+                const float* gQ = &m_Irradiance[1][rowQ];
+                const float* bQ = &m_Irradiance[2][rowQ];
+
+                int x = xBegin;
+#ifdef DENOISER_SSE2
+                const __m128 hV = _mm_set1_ps(h);
+                const __m128 invAlbedoSigmaV = _mm_set1_ps(invAlbedoSigma);
+                for (; x + 4 <= xEnd; x += 4)
+                {
+                    const int q = x + dx;
+                    __m128 normalWeight = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(_mm_loadu_ps(nxP + x), _mm_loadu_ps(nxQ + q)),
+                        _mm_mul_ps(_mm_loadu_ps(nyP + x), _mm_loadu_ps(nyQ + q))),
+                        _mm_mul_ps(_mm_loadu_ps(nzP + x), _mm_loadu_ps(nzQ + q)));
+                    normalWeight = _mm_max_ps(normalWeight, _mm_setzero_ps());
+                    for (int i = 0; i < normalSharpness; i++)
+                        normalWeight = _mm_mul_ps(normalWeight, normalWeight);
+
+                    __m128 luminanceDelta = _mm_sub_ps(_mm_loadu_ps(lumP + x), _mm_loadu_ps(lumQ + q));
+                    __m128 colorDistance = _mm_mul_ps(_mm_mul_ps(luminanceDelta, luminanceDelta), _mm_loadu_ps(&colorScale[x]));
+                    __m128 depthDistance = _mm_mul_ps(Abs(_mm_sub_ps(_mm_loadu_ps(depthP + x), _mm_loadu_ps(depthQ + q))), _mm_loadu_ps(&depthScale[x]));
+                    __m128 albedoDistance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+                        Abs(_mm_sub_ps(_mm_loadu_ps(arP + x), _mm_loadu_ps(arQ + q))),
+                        Abs(_mm_sub_ps(_mm_loadu_ps(agP + x), _mm_loadu_ps(agQ + q)))),
+                        Abs(_mm_sub_ps(_mm_loadu_ps(abP + x), _mm_loadu_ps(abQ + q)))), invAlbedoSigmaV);
+
+                    __m128 distance = _mm_add_ps(_mm_add_ps(colorDistance, depthDistance), albedoDistance);
+                    __m128 weight = _mm_mul_ps(_mm_mul_ps(hV, normalWeight), ExpNonPositive(_mm_sub_ps(_mm_setzero_ps(), distance)));
+                    _mm_storeu_ps(&sumR[x], _mm_add_ps(_mm_loadu_ps(&sumR[x]), _mm_mul_ps(weight, _mm_loadu_ps(rQ + q))));
+                    _mm_storeu_ps(&sumG[x], _mm_add_ps(_mm_loadu_ps(&sumG[x]), _mm_mul_ps(weight, _mm_loadu_ps(gQ + q))));
+                    _mm_storeu_ps(&sumB[x], _mm_add_ps(_mm_loadu_ps(&sumB[x]), _mm_mul_ps(weight, _mm_loadu_ps(bQ + q))));
+                    _mm_storeu_ps(&sumW[x], _mm_add_ps(_mm_loadu_ps(&sumW[x]), weight));
+                }
+#endif
+                for (; x < xEnd; x++)
+                {
+                    const int q = x + dx;
+                    float normalWeight = std::max(0.0f, nxP[x] * nxQ[q] + nyP[x] * nyQ[q] + nzP[x] * nzQ[q]);
+                    for (int i = 0; i < normalSharpness; i++)
+                        normalWeight *= normalWeight;
+
+                    float luminanceDelta = lumP[x] - lumQ[q];
+                    float colorDistance = luminanceDelta * luminanceDelta * colorScale[x];
+                    float depthDistance = std::fabs(depthP[x] - depthQ[q]) * depthScale[x];
+                    float albedoDistance = (std::fabs(arP[x] - arQ[q]) + std::fabs(agP[x] - agQ[q]) + std::fabs(abP[x] - abQ[q])) * invAlbedoSigma;
+
+                    float weight = h * normalWeight * ExpNonPositive(-(colorDistance + depthDistance + albedoDistance));
+                    sumR[x] += weight * rQ[q];
+                    sumG[x] += weight * gQ[q];
+                    sumB[x] += weight * bQ[q];
+                    sumW[x] += weight;
+                }
+            }
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            float invWeight = 1.0f / sumW[x];
+            m_Filtered[0][rowP + x] = sumR[x] * invWeight;
+            m_Filtered[1][rowP + x] = sumG[x] * invWeight;
+            m_Filtered[2][rowP + x] = sumB[x] * invWeight;
+            m_FilteredLuminance[rowP + x] = Luminance(m_Filtered[0][rowP + x], m_Filtered[1][rowP + x], m_Filtered[2][rowP + x]);
+        }
+    }
+}
+
+void Denoiser::Remodulate(uint32_t y0, uint32_t y1)
+{
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        size_t row = (size_t)y * m_Width;
+        for (int c = 0; c < 3; c++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+                m_Output[c][row + x] = m_Irradiance[c][row + x] * std::max(m_Albedo[c][row + x], minAlbedo);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Picks the pixel stride of the next render pass. While the camera moves the
+// stride is the smallest one whose estimated pass time fits the target frame
+// time. Once the camera is still the stride steps down one level per pass,
+// 1/16 to 1/4 to full resolution, and the passes refine the image from there.
+class DynamicResolution
+{
+public:
+    constexpr static uint32_t maxStride = 4;
+
+    void SetEnabled(bool enabled) { m_Enabled = enabled; }
+    bool IsEnabled() const { return m_Enabled; }
+    // In milliseconds
+    void SetTargetFrameTime(float frameTime) { m_TargetFrameTime = frameTime; }
+    float GetTargetFrameTime() const { return m_TargetFrameTime; }
+
+    uint32_t GetPixelStride() const { return m_Enabled ? m_Stride : 1; }
+
+    // Called after every pass with the time it took to render, the fraction
+    // of the pass its budget allowed and whether the camera moved since the
+    // pass before
+    void Update(float renderTime, float passFraction, bool cameraMoving)
+    {
+        // The pass time scales with the traced pixel count, 1 / stride^2
+        float fullResolutionTime = renderTime * (float)(m_Stride * m_Stride) / std::max(passFraction, minPassFraction);
+        if (m_FullResolutionTime <= 0.0f)
+            m_FullResolutionTime = fullResolutionTime;
+        else
+            m_FullResolutionTime += smoothing * (fullResolutionTime - m_FullResolutionTime);
+
+        if (!m_Enabled)
+            return;
+
+        if (!cameraMoving)
+        {
+            m_Stride = std::max(m_Stride / 2, 1u);
+            return;
+        }
+
+        m_Stride = 1;
+        while (m_Stride < maxStride && m_FullResolutionTime / (float)(m_Stride * m_Stride) > m_TargetFrameTime)
+            m_Stride *= 2;
+    }
+
+private:
+    // Weight of the newest pass in the running estimate
+    constexpr static float smoothing = 0.25f;
+    // Keeps the estimate finite when a pass was cancelled before any pixel
+    constexpr static float minPassFraction = 0.01f;
+
+    bool m_Enabled = true;
+    float m_TargetFrameTime = 33.0f;
+    uint32_t m_Stride = 1;
+    // Estimated time of a pass at stride 1
+    float m_FullResolutionTime = 0.0f;
+};
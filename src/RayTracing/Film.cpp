@@ -0,0 +1,494 @@
+#include "Film.h"
+#include "Camera.h"
+#include "core/Trace.h"
+#include <future>
+#include <limits>
+
+constexpr static float gaussianSigma = 0.5f;
+// Relative view depth by which a neighbour has to be nearer to hide a pixel
+constexpr static float disocclusionThreshold = 0.1f;
+constexpr static uint32_t invalidSource = ~0u;
+
+Film::Film(uint32_t width, uint32_t height, uint32_t tileSize)
+    : m_Width(width), m_Height(height), m_TileSize(tileSize)
+{
+    m_TilesX = (width + tileSize - 1) / tileSize;
+    m_TilesY = (height + tileSize - 1) / tileSize;
+
+    size_t pixelCount = (size_t)GetTileCount() * tileSize * tileSize;
+    m_Color.resize(pixelCount);
+    for (auto& plane : m_AOVs)
+        plane.resize(pixelCount);
+
+    m_Tiles.resize(GetTileCount());
+    for (uint32_t i = 0; i < GetTileCount(); i++)
+    {
+        m_Tiles[i].m_Film = this;
+        m_Tiles[i].m_TileIndex = i;
+        m_Tiles[i].m_Bounds = GetTileBounds(i);
+    }
+    SetFilter(FilterType::Box);
+}
+
+void Film::SetFilter(FilterType filter)
+{
+    m_Filter = filter;
+    switch (filter)
+    {
+    case FilterType::Box:
+        m_FilterRadius = 0.5f;
+        break;
+    case FilterType::Tent:
+        m_FilterRadius = 1.0f;
+        break;
+    case FilterType::Gaussian:
+        m_FilterRadius = 1.5f;
+        break;
+    }
+
+    // A sample inside pixel i reaches pixels up to floor(i + 0.5 + radius)
+    int border = filter == FilterType::Box ? 0 : (int)std::floor(0.5f + m_FilterRadius);
+    for (auto& tile : m_Tiles)
+    {
+        tile.m_Border = border;
+        tile.m_Stride = m_TileSize + 2 * border;
+        tile.m_Pixels.assign((size_t)tile.m_Stride * tile.m_Stride, FilmPixel{});
+    }
+}
+
+void Film::Clear()
+{
+    std::fill(m_Color.begin(), m_Color.end(), FilmPixel{});
+    for (auto& plane : m_AOVs)
+        std::fill(plane.begin(), plane.end(), FilmPixel{});
+    m_CoveredPixelCount = 0;
+}
+
+Tile Film::GetTileBounds(uint32_t tileIndex) const
+{
+    uint32_t x0 = (tileIndex % m_TilesX) * m_TileSize;
+    uint32_t y0 = (tileIndex / m_TilesX) * m_TileSize;
+    return Tile{ x0, y0, std::min(x0 + m_TileSize, m_Width), std::min(y0 + m_TileSize, m_Height) };
+}
+
+FilmTile& Film::BeginTile(uint32_t tileIndex)
+{
+    auto& tile = m_Tiles[tileIndex];
+    std::fill(tile.m_Pixels.begin(), tile.m_Pixels.end(), FilmPixel{});
+    tile.m_Active = true;
+    tile.m_NewlyCovered = 0;
+    return tile;
+}
+
+float Film::EvaluateFilter(float offset) const
+{
+    offset = std::fabs(offset);
+    switch (m_Filter)
+    {
+    case FilterType::Box:
+        return offset <= m_FilterRadius ? 1.0f : 0.0f;
+    case FilterType::Tent:
+        return std::max(0.0f, m_FilterRadius - offset);
+    case FilterType::Gaussian:
+    {
+        // Shifted down so the weight reaches zero at the radius
+        auto gaussian = [](float x) { return std::exp(-x * x / (2.0f * gaussianSigma * gaussianSigma)); };
+        return std::max(0.0f, gaussian(offset) - gaussian(m_FilterRadius));
+    }
+    }
+    return 0.0f;
+}
+
+void FilmTile::AddSample(const glm::vec2& pFilm, const FilmSample& sample)
+{
+    // The pixel that owns the sample, always inside this tile
+    int px = std::clamp((int)std::floor(pFilm.x), (int)m_Bounds.x0, (int)m_Bounds.x1 - 1);
+    int py = std::clamp((int)std::floor(pFilm.y), (int)m_Bounds.y0, (int)m_Bounds.y1 - 1);
+
+    size_t pixelIndex = m_Film->PixelIndex(px, py);
+    if (m_Film->m_AOVEnabled[(int)FilmAOV::Albedo])
+    {
+        auto& albedo = m_Film->m_AOVs[(int)FilmAOV::Albedo][pixelIndex];
+        albedo.R += sample.Albedo.r;
+        albedo.G += sample.Albedo.g;
+        albedo.B += sample.Albedo.b;
+    }
+    if (m_Film->m_AOVEnabled[(int)FilmAOV::Normal])
+    {
+        auto& normal = m_Film->m_AOVs[(int)FilmAOV::Normal][pixelIndex];
+        normal.R += sample.Normal.x;
+        normal.G += sample.Normal.y;
+        normal.B += sample.Normal.z;
+    }
+    if (m_Film->m_AOVEnabled[(int)FilmAOV::Depth])
+        m_Film->m_AOVs[(int)FilmAOV::Depth][pixelIndex].R += sample.Depth;
+    if (m_Film->m_AOVEnabled[(int)FilmAOV::Position] && sample.Depth > 0.0f)
+    {
+        auto& position = m_Film->m_AOVs[(int)FilmAOV::Position][pixelIndex];
+        position.R += sample.Position.x;
+        position.G += sample.Position.y;
+        position.B += sample.Position.z;
+        position.A += 1.0f;
+    }
+    // The count is kept even when disabled, the other AOVs are divided by it
+    auto& count = m_Film->m_AOVs[(int)FilmAOV::SampleCount][pixelIndex];
+    if (count.R == 0.0f)
+        m_NewlyCovered++;
+    count.R += 1.0f;
+    count.G += 1.0f;
+
+    int originX = (int)m_Bounds.x0 - m_Border;
+    int originY = (int)m_Bounds.y0 - m_Border;
+
+    if (m_Film->m_Filter == FilterType::Box)
+    {
+        auto& pixel = m_Pixels[(py - originY) * m_Stride + (px - originX)];
+        pixel.R += sample.L.r;
+        pixel.G += sample.L.g;
+        pixel.B += sample.L.b;
+        pixel.A += 1.0f;
+        return;
+    }
+
+    // Pixels whose centre lies within the filter radius, clipped to the image
+    float radius = m_Film->m_FilterRadius;
+    int x0 = std::max((int)std::ceil(pFilm.x - 0.5f - radius), std::max(px - m_Border, 0));
+    int x1 = std::min((int)std::floor(pFilm.x - 0.5f + radius), std::min(px + m_Border, (int)m_Film->m_Width - 1));
+    int y0 = std::max((int)std::ceil(pFilm.y - 0.5f - radius), std::max(py - m_Border, 0));
+    int y1 = std::min((int)std::floor(pFilm.y - 0.5f + radius), std::min(py + m_Border, (int)m_Film->m_Height - 1));
+
+    // The filters are separable
+    float weightsX[8];
+    for (int x = x0; x <= x1; x++)
+        weightsX[x - x0] = m_Film->EvaluateFilter(x + 0.5f - pFilm.x);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        float weightY = m_Film->EvaluateFilter(y + 0.5f - pFilm.y);
+        if (weightY <= 0.0f)
+            continue;
+
+        auto row = m_Pixels.data() + (y - originY) * m_Stride;
+        for (int x = x0; x <= x1; x++)
+        {
+            float weight = weightsX[x - x0] * weightY;
+            auto& pixel = row[x - originX];
+            pixel.R += weight * sample.L.r;
+            pixel.G += weight * sample.L.g;
+            pixel.B += weight * sample.L.b;
+            pixel.A += weight;
+        }
+    }
+}
+
+void Film::MergeTile(uint32_t tileIndex)
+{
+    auto bounds = GetTileBounds(tileIndex);
+    int tileX = (int)(tileIndex % m_TilesX);
+    int tileY = (int)(tileIndex / m_TilesX);
+
+    for (int ny = std::max(tileY - 1, 0); ny <= std::min(tileY + 1, (int)m_TilesY - 1); ny++)
+    {
+        for (int nx = std::max(tileX - 1, 0); nx <= std::min(tileX + 1, (int)m_TilesX - 1); nx++)
+        {
+            const auto& source = m_Tiles[ny * m_TilesX + nx];
+            if (!source.m_Active)
+                continue;
+
+            int originX = (int)source.m_Bounds.x0 - source.m_Border;
+            int originY = (int)source.m_Bounds.y0 - source.m_Border;
+
+            // Overlap of the source buffer with this tile
+            int x0 = std::max(originX, (int)bounds.x0);
+            int x1 = std::min(originX + source.m_Stride, (int)bounds.x1);
+            int y0 = std::max(originY, (int)bounds.y0);
+            int y1 = std::min(originY + source.m_Stride, (int)bounds.y1);
+
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    const auto& from = source.m_Pixels[(y - originY) * source.m_Stride + (x - originX)];
+                    auto& to = m_Color[PixelIndex(x, y)];
+                    to.R += from.R;
+                    to.G += from.G;
+                    to.B += from.B;
+                    to.A += from.A;
+                }
+            }
+        }
+    }
+}
+
+void Film::MergeTiles()
+{
+    TRACE_SCOPE("Merge tiles");
+    std::vector<std::future<void>> futures;
+    for (uint32_t tileY = 0; tileY < m_TilesY; tileY++)
+    {
+        futures.push_back(std::async(std::launch::async, [this, tileY]() {
+            TRACE_THREAD_NAME("Film worker");
+            TRACE_SCOPE("Merge tile row");
+            for (uint32_t tileX = 0; tileX < m_TilesX; tileX++)
+                MergeTile(tileY * m_TilesX + tileX);
+        }));
+    }
+
+    for (auto& fut : futures)
+        fut.get();
+
+    for (auto& tile : m_Tiles)
+    {
+        if (tile.m_Active)
+            m_CoveredPixelCount += tile.m_NewlyCovered;
+        tile.m_Active = false;
+    }
+}
+
+bool Film::IsHole(int x, int y) const
+{
+    float depth = m_ReprojectedDepth[(size_t)y * m_Width + x] * (1.0f - disocclusionThreshold);
+    auto nearer = [&](int nx, int ny) {
+        if (nx < 0 || ny < 0 || nx >= (int)m_Width || ny >= (int)m_Height)
+            return false;
+        return m_ReprojectedDepth[(size_t)ny * m_Width + nx] < depth;
+    };
+
+    // At a silhouette the nearer surface is on one side only
+    return (nearer(x - 1, y) && nearer(x + 1, y)) || (nearer(x, y - 1) && nearer(x, y + 1));
+}
+
+uint32_t Film::GetCrackSource(int x, int y) const
+{
+    // A surface stretched by the new view leaves single pixels without a
+    // splat, they borrow the history of a neighbour when the surface
+    // continues on both sides
+    auto valid = [&](int nx, int ny) {
+        return nx >= 0 && ny >= 0 && nx < (int)m_Width && ny < (int)m_Height &&
+            m_ReprojectedSource[(size_t)ny * m_Width + nx] != invalidSource;
+    };
+    auto sameSurface = [&](size_t a, size_t b) {
+        float depthA = m_ReprojectedDepth[a];
+        float depthB = m_ReprojectedDepth[b];
+        return std::fabs(depthA - depthB) < disocclusionThreshold * std::min(depthA, depthB);
+    };
+
+    size_t index = (size_t)y * m_Width + x;
+    if (valid(x - 1, y) && valid(x + 1, y) && sameSurface(index - 1, index + 1))
+        return m_ReprojectedSource[index - 1];
+    if (valid(x, y - 1) && valid(x, y + 1) && sameSurface(index - m_Width, index + m_Width))
+        return m_ReprojectedSource[index - m_Width];
+    return invalidSource;
+}
+
+void Film::Reproject(const Camera& camera, float maxSampleCount)
+{
+    TRACE_SCOPE("Reproject");
+    if (camera.GetProjection() == CameraProjection::Environment ||
+        !m_AOVEnabled[(int)FilmAOV::Position] || !m_AOVEnabled[(int)FilmAOV::Normal])
+    {
+        Clear();
+        return;
+    }
+
+    std::swap(m_Color, m_HistoryColor);
+    for (int i = 0; i < (int)FilmAOV::Count; i++)
+        std::swap(m_AOVs[i], m_HistoryAOVs[i]);
+    m_Color.resize(m_HistoryColor.size());
+    for (int i = 0; i < (int)FilmAOV::Count; i++)
+        m_AOVs[i].resize(m_HistoryAOVs[i].size());
+    Clear();
+
+    size_t pixelCount = (size_t)m_Width * m_Height;
+    m_ReprojectedDepth.assign(pixelCount, std::numeric_limits<float>::infinity());
+    m_ReprojectedSource.assign(pixelCount, invalidSource);
+
+    glm::mat4 viewProjection = camera.GetViewProjection();
+    glm::vec3 cameraPosition = camera.GetPosition();
+    glm::vec3 viewDir = camera.GetViewDir();
+    bool orthographic = camera.GetProjection() == CameraProjection::Orthographic;
+
+    const auto& positions = m_HistoryAOVs[(int)FilmAOV::Position];
+    const auto& normals = m_HistoryAOVs[(int)FilmAOV::Normal];
+    const auto& counts = m_HistoryAOVs[(int)FilmAOV::SampleCount];
+
+    // Splat every pixel to its new position, the nearest surface wins. Pixels
+    // where a sample escaped keep no history, the sky converges in a single
+    // sample anyway.
+    for (uint32_t y = 0; y < m_Height; y++)
+    {
+        for (uint32_t x = 0; x < m_Width; x++)
+        {
+            size_t source = PixelIndex(x, y);
+            const auto& position = positions[source];
+            if (position.A <= 0.0f || position.A < counts[source].R)
+                continue;
+
+            glm::vec3 p = glm::vec3(position.R, position.G, position.B) / position.A;
+            glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+            if (clip.w <= 0.0f)
+                continue;
+
+            float ndcX = clip.x / clip.w;
+            float ndcY = clip.y / clip.w;
+            float ndcZ = clip.z / clip.w;
+            if (ndcZ < 0.0f || ndcZ > 1.0f)
+                continue;
+
+            int targetX = (int)std::floor((0.5f + 0.5f * ndcX) * m_Width);
+            int targetY = (int)std::floor((0.5f - 0.5f * ndcY) * m_Height);
+            if (targetX < 0 || targetY < 0 || targetX >= (int)m_Width || targetY >= (int)m_Height)
+                continue;
+
+            glm::vec3 normal(normals[source].R, normals[source].G, normals[source].B);
+            glm::vec3 toCamera = orthographic ? -viewDir : cameraPosition - p;
+            if (glm::dot(normal, toCamera) <= 0.0f)
+                continue;
+
+            size_t target = (size_t)targetY * m_Width + targetX;
+            float depth = glm::dot(p - cameraPosition, viewDir);
+            if (depth < m_ReprojectedDepth[target])
+            {
+                m_ReprojectedDepth[target] = depth;
+                m_ReprojectedSource[target] = (uint32_t)source;
+            }
+        }
+    }
+
+    // Every target pixel is written once, so the rows are copied in parallel
+    std::vector<std::future<void>> futures;
+    for (uint32_t tileY = 0; tileY < m_TilesY; tileY++)
+    {
+        futures.push_back(std::async(std::launch::async, [this, tileY, maxSampleCount]() {
+            TRACE_THREAD_NAME("Film worker");
+            TRACE_SCOPE("Reproject row");
+            uint32_t y1 = std::min((tileY + 1) * m_TileSize, m_Height);
+            for (uint32_t y = tileY * m_TileSize; y < y1; y++)
+            {
+                for (uint32_t x = 0; x < m_Width; x++)
+                {
+                    uint32_t source = m_ReprojectedSource[(size_t)y * m_Width + x];
+                    if (source == invalidSource)
+                        source = GetCrackSource(x, y);
+                    else if (IsHole(x, y))
+                        continue;
+                    if (source == invalidSource)
+                        continue;
+
+                    float count = m_HistoryAOVs[(int)FilmAOV::SampleCount][source].R;
+                    float scale = count > maxSampleCount ? maxSampleCount / count : 1.0f;
+                    auto carry = [&](FilmPixel& to, const FilmPixel& from) {
+                        to.R = from.R * scale;
+                        to.G = from.G * scale;
+                        to.B = from.B * scale;
+                        to.A = from.A * scale;
+                    };
+
+                    size_t target = PixelIndex(x, y);
+                    carry(m_Color[target], m_HistoryColor[source]);
+                    for (int i = 0; i < (int)FilmAOV::Count; i++)
+                        carry(m_AOVs[i][target], m_HistoryAOVs[i][source]);
+                    // The sequence continues where the source pixel left off
+                    m_AOVs[(int)FilmAOV::SampleCount][target].G = m_HistoryAOVs[(int)FilmAOV::SampleCount][source].G;
+                }
+            }
+        }));
+    }
+
+    for (auto& fut : futures)
+        fut.get();
+
+    // Padding pixels of the border tiles stay empty
+    m_CoveredPixelCount = 0;
+    for (const auto& count : m_AOVs[(int)FilmAOV::SampleCount])
+        m_CoveredPixelCount += count.R > 0.0f;
+}
+
+glm::vec3 Film::GetPixelColor(uint32_t x, uint32_t y) const
+{
+    const auto& pixel = m_Color[PixelIndex(x, y)];
+    if (pixel.A <= 0.0f)
+        return glm::vec3(0.0f);
+    return glm::vec3(pixel.R, pixel.G, pixel.B) / pixel.A;
+}
+
+glm::vec3 Film::GetUpscaledPixelColor(uint32_t x, uint32_t y, uint32_t maxBlockSize) const
+{
+    if (m_Color[PixelIndex(x, y)].A > 0.0f)
+        return GetPixelColor(x, y);
+
+    for (uint32_t blockSize = 2; blockSize <= maxBlockSize; blockSize *= 2)
+    {
+        uint32_t x0 = x - x % blockSize;
+        uint32_t y0 = y - y % blockSize;
+        uint32_t x1 = std::min(x0 + blockSize, m_Width);
+        uint32_t y1 = std::min(y0 + blockSize, m_Height);
+
+        glm::vec3 sum{ 0.0f };
+        int count = 0;
+        for (uint32_t by = y0; by < y1; by++)
+        {
+            for (uint32_t bx = x0; bx < x1; bx++)
+            {
+                if (m_Color[PixelIndex(bx, by)].A > 0.0f)
+                {
+                    sum += GetPixelColor(bx, by);
+                    count++;
+                }
+            }
+        }
+        if (count > 0)
+            return sum / (float)count;
+    }
+    return glm::vec3(0.0f);
+}
+
+glm::vec3 Film::GetAOV(FilmAOV aov, uint32_t x, uint32_t y) const
+{
+    size_t pixelIndex = PixelIndex(x, y);
+    float count = m_AOVs[(int)FilmAOV::SampleCount][pixelIndex].R;
+    if (aov == FilmAOV::SampleCount)
+        return glm::vec3(count, 0.0f, 0.0f);
+    if (count <= 0.0f)
+        return glm::vec3(0.0f);
+
+    const auto& pixel = m_AOVs[(int)aov][pixelIndex];
+    if (aov == FilmAOV::Position)
+        return pixel.A > 0.0f ? glm::vec3(pixel.R, pixel.G, pixel.B) / pixel.A : glm::vec3(0.0f);
+    return glm::vec3(pixel.R, pixel.G, pixel.B) / count;
+}
+
+void Film::ResolveRow(uint32_t y, const FilmRowPlanes& planes) const
+{
+    const auto& albedos = m_AOVs[(int)FilmAOV::Albedo];
+    const auto& normals = m_AOVs[(int)FilmAOV::Normal];
+    const auto& depths = m_AOVs[(int)FilmAOV::Depth];
+    const auto& counts = m_AOVs[(int)FilmAOV::SampleCount];
+
+    // Pixels of a row are contiguous within a tile
+    for (uint32_t x0 = 0; x0 < m_Width; x0 += m_TileSize)
+    {
+        size_t first = PixelIndex(x0, y);
+        uint32_t x1 = std::min(x0 + m_TileSize, m_Width);
+        for (uint32_t x = x0; x < x1; x++)
+        {
+            size_t pixelIndex = first + (x - x0);
+            const auto& color = m_Color[pixelIndex];
+            float invWeight = color.A > 0.0f ? 1.0f / color.A : 0.0f;
+            planes.Color[0][x] = color.R * invWeight;
+            planes.Color[1][x] = color.G * invWeight;
+            planes.Color[2][x] = color.B * invWeight;
+
+            float count = counts[pixelIndex].R;
+            float invCount = count > 0.0f ? 1.0f / count : 0.0f;
+            planes.Albedo[0][x] = albedos[pixelIndex].R * invCount;
+            planes.Albedo[1][x] = albedos[pixelIndex].G * invCount;
+            planes.Albedo[2][x] = albedos[pixelIndex].B * invCount;
+            planes.Normal[0][x] = normals[pixelIndex].R * invCount;
+            planes.Normal[1][x] = normals[pixelIndex].G * invCount;
+            planes.Normal[2][x] = normals[pixelIndex].B * invCount;
+            planes.Depth[x] = depths[pixelIndex].R * invCount;
+            planes.SampleCount[x] = count;
+        }
+    }
+}
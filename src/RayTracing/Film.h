@@ -0,0 +1,182 @@
+#pragma once
+
+#include "Geometry.h"
+#include "core/AlignedAllocator.h"
+#include <vector>
+
+struct Tile
+{
+    uint32_t x0, y0, x1, y1;
+};
+
+enum class FilterType
+{
+    Box,        // radius 0.5, a sample only reaches its own pixel
+    Tent,       // radius 1
+    Gaussian    // radius 1.5, sigma 0.5
+};
+
+// Auxiliary outputs, averaged over the samples of a pixel without filtering
+enum class FilmAOV
+{
+    Albedo,
+    Normal,
+    Depth,          // distance to the first hit, 0 when the ray escaped
+    Position,       // world position of the first hit, A counts the hits
+    SampleCount,    // R weighs the history, G is the next sequence index
+    Count
+};
+
+// Color pixels hold the filter weighted radiance in RGB and the weight sum
+// in A. AOV pixels hold sums in RGB, divided by the sample count on read.
+struct alignas(16) FilmPixel
+{
+    float R = 0.0f;
+    float G = 0.0f;
+    float B = 0.0f;
+    float A = 0.0f;
+};
+
+using FilmPlane = std::vector<FilmPixel, AlignedAllocator<FilmPixel, CacheLineSize>>;
+
+// What a camera sample contributes besides its position
+struct FilmSample
+{
+    glm::vec3 L{ 0.0f };
+    glm::vec3 Albedo{ 0.0f };
+    glm::vec3 Normal{ 0.0f };
+    float Depth = 0.0f;
+    glm::vec3 Position{ 0.0f };
+};
+
+// Destination planes of Film::ResolveRow, each holds at least a row
+struct FilmRowPlanes
+{
+    float* Color[3];
+    float* Albedo[3];
+    float* Normal[3];
+    float* Depth;
+    float* SampleCount;
+};
+
+class Camera;
+class Film;
+
+// Buffer a single render task writes into. Filtered samples reach beyond the
+// tile, so the color buffer has a border of the filter radius, which Film::
+// MergeTiles gathers into the neighbouring tiles after the pass. AOVs are not
+// filtered and go straight into the film, the tile owns those pixels.
+class FilmTile
+{
+public:
+    void AddSample(const glm::vec2& pFilm, const FilmSample& sample);
+    const Tile& GetBounds() const { return m_Bounds; }
+
+private:
+    friend class Film;
+
+    Film* m_Film = nullptr;
+    uint32_t m_TileIndex = 0;
+    Tile m_Bounds{};
+    // Set by BeginTile, tiles that were not rendered in a pass are not merged
+    bool m_Active = false;
+    // Pixels that got their first sample in this pass
+    uint32_t m_NewlyCovered = 0;
+    int m_Border = 0;
+    int m_Stride = 0;
+    FilmPlane m_Pixels;
+};
+
+// Progressive accumulation target. Pixels are stored tile by tile and with an
+// even tile size every tile is a whole number of cache lines, so render tasks
+// never write to a cache line another task touches.
+class Film
+{
+public:
+    Film(uint32_t width, uint32_t height, uint32_t tileSize = 16);
+
+    void SetFilter(FilterType filter);
+    FilterType GetFilter() const { return m_Filter; }
+    void SetAOVEnabled(FilmAOV aov, bool enabled) { m_AOVEnabled[(int)aov] = enabled; }
+    bool IsAOVEnabled(FilmAOV aov) const { return m_AOVEnabled[(int)aov]; }
+
+    void Clear();
+    // True once every pixel has a sample, passes can be cut short by their
+    // budget or trace only some pixels
+    bool IsCovered() const { return m_CoveredPixelCount == (size_t)m_Width * m_Height; }
+
+    uint32_t GetWidth() const { return m_Width; }
+    uint32_t GetHeight() const { return m_Height; }
+    uint32_t GetTileCount() const { return m_TilesX * m_TilesY; }
+    Tile GetTileBounds(uint32_t tileIndex) const;
+
+    // Clears and returns the tile-local buffer, one render task per tile
+    FilmTile& BeginTile(uint32_t tileIndex);
+    // Adds the tile-local buffers of the pass into the film. Every tile
+    // gathers from its own and its neighbours' buffers, so tiles are merged
+    // in parallel without locks.
+    void MergeTiles();
+
+    // Moves the accumulated pixels to where their first hit lands in the view
+    // of the moved camera, so the samples survive camera motion. Surfaces
+    // turned away from the camera or seen through gaps of a nearer surface
+    // are dropped, and the carried sample count is clamped to maxSampleCount
+    // so stale shading fades out. Falls back to Clear for projections
+    // without a view-projection matrix.
+    void Reproject(const Camera& camera, float maxSampleCount);
+
+    glm::vec3 GetPixelColor(uint32_t x, uint32_t y) const;
+    // For passes with a pixel stride: a pixel without samples shows the
+    // average of the sampled pixels of its aligned 2x2 block, or of the
+    // larger blocks up to maxBlockSize when that one is empty too
+    glm::vec3 GetUpscaledPixelColor(uint32_t x, uint32_t y, uint32_t maxBlockSize) const;
+    // Albedo, normal and depth are averages over the samples, position over
+    // the samples that hit, SampleCount is in x
+    glm::vec3 GetAOV(FilmAOV aov, uint32_t x, uint32_t y) const;
+    // Samples ever taken for the pixel, including reprojected ones. Unlike
+    // the sample count it is not clamped by Reproject, so a pixel never
+    // draws a sampler index its history already holds.
+    uint32_t GetSampleIndex(uint32_t x, uint32_t y) const
+    {
+        return (uint32_t)m_AOVs[(int)FilmAOV::SampleCount][PixelIndex(x, y)].G;
+    }
+    // GetPixelColor and the albedo, normal, depth and sample count AOVs of a
+    // whole row, walks the tiled layout once instead of once per pixel
+    void ResolveRow(uint32_t y, const FilmRowPlanes& planes) const;
+
+private:
+    friend class FilmTile;
+
+    size_t PixelIndex(uint32_t x, uint32_t y) const
+    {
+        uint32_t tileIndex = (y / m_TileSize) * m_TilesX + x / m_TileSize;
+        return (size_t)tileIndex * m_TileSize * m_TileSize + (y % m_TileSize) * m_TileSize + x % m_TileSize;
+    }
+
+    float EvaluateFilter(float offset) const;
+    void MergeTile(uint32_t tileIndex);
+    bool IsHole(int x, int y) const;
+    uint32_t GetCrackSource(int x, int y) const;
+
+    uint32_t m_Width;
+    uint32_t m_Height;
+    uint32_t m_TileSize;
+    uint32_t m_TilesX;
+    uint32_t m_TilesY;
+
+    FilterType m_Filter = FilterType::Box;
+    float m_FilterRadius = 0.5f;
+
+    FilmPlane m_Color;
+    FilmPlane m_AOVs[(int)FilmAOV::Count];
+    bool m_AOVEnabled[(int)FilmAOV::Count] = { true, true, true, true, true };
+
+    std::vector<FilmTile> m_Tiles;
+    size_t m_CoveredPixelCount = 0;
+
+    // Previous accumulation and per-pixel splat target of Reproject
+    FilmPlane m_HistoryColor;
+    FilmPlane m_HistoryAOVs[(int)FilmAOV::Count];
+    std::vector<float> m_ReprojectedDepth;
+    std::vector<uint32_t> m_ReprojectedSource;
+};
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "core/Core.h"
+#include <algorithm>
+#include <vector>
 
 struct Ray
 {
     glm::vec3 Origin{ 0.0f };
     glm::vec3 Direction{ 0.0f, 0.0f, 1.0f };
+    // Normalized shutter time in [0, 1]
+    float Time = 0.0f;
 
     void Normalize()
     {
@@ -58,6 +62,31 @@ struct Ray
     }
 };
 
+// Per-ray setup of the watertight triangle test (Woop et al. 2013). The
+// dimension where the direction is largest becomes z, and the shear maps the
+// direction onto +z so the edge tests are done in 2D.
+struct RayShear
+{
+    RayShear() = default;
+    explicit RayShear(const glm::vec3& direction)
+    {
+        glm::vec3 absDirection = glm::abs(direction);
+        Kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+        Kx = (Kz + 1) % 3;
+        Ky = (Kx + 1) % 3;
+        // Keeps the winding of the triangles
+        if (direction[Kz] < 0.0f)
+            std::swap(Kx, Ky);
+
+        Sx = direction[Kx] / direction[Kz];
+        Sy = direction[Ky] / direction[Kz];
+        Sz = 1.0f / direction[Kz];
+    }
+
+    int Kx = 0, Ky = 1, Kz = 2;
+    float Sx = 0.0f, Sy = 0.0f, Sz = 1.0f;
+};
+
 class Transform
 {
 public:
@@ -114,6 +143,78 @@ private:
     glm::mat4 m_InvMat{ 1.0f };
 };
 
+struct TransformKeyframe
+{
+    float Time;
+    glm::vec3 Scale;
+    glm::vec3 EulerAngles;  // radians
+    glm::vec3 Translation;
+};
+
+// Keyframed transform over the normalized shutter interval. Scale, rotation
+// and translation are interpolated separately so the inverse stays cheap.
+class MotionTransform
+{
+public:
+    MotionTransform() = default;
+
+    void AddKeyframe(float time, const glm::vec3& scale, const glm::vec3& eulerAngles, const glm::vec3& translation)
+    {
+        TransformKeyframe keyframe{ time, scale, eulerAngles, translation };
+        auto it = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), time,
+            [](float t, const TransformKeyframe& k) { return t < k.Time; });
+        m_Keyframes.insert(it, keyframe);
+    }
+
+    void Clear()                                            { m_Keyframes.clear(); }
+    bool IsAnimated() const                                 { return m_Keyframes.size() > 1; }
+    const std::vector<TransformKeyframe>& GetKeyframes() const { return m_Keyframes; }
+
+    Transform Interpolate(float time) const
+    {
+        if (m_Keyframes.empty())
+            return Transform();
+
+        if (time <= m_Keyframes.front().Time)
+            return Compose(m_Keyframes.front().Scale, m_Keyframes.front().EulerAngles, m_Keyframes.front().Translation);
+        if (time >= m_Keyframes.back().Time)
+            return Compose(m_Keyframes.back().Scale, m_Keyframes.back().EulerAngles, m_Keyframes.back().Translation);
+
+        size_t i = 1;
+        while (m_Keyframes[i].Time < time)
+            i++;
+
+        const auto& k0 = m_Keyframes[i - 1];
+        const auto& k1 = m_Keyframes[i];
+        float dt = k1.Time - k0.Time;
+        float u = dt > 0.0f ? (time - k0.Time) / dt : 0.0f;
+
+        return Compose(
+            glm::mix(k0.Scale, k1.Scale, u),
+            glm::mix(k0.EulerAngles, k1.EulerAngles, u),
+            glm::mix(k0.Translation, k1.Translation, u)
+        );
+    }
+
+private:
+    static Transform Compose(const glm::vec3& scale, const glm::vec3& eulerAngles, const glm::vec3& translation)
+    {
+        glm::mat4 rotation = glm::eulerAngleXYZ(eulerAngles.x, eulerAngles.y, eulerAngles.z);
+        glm::mat4 mat = 
+            glm::translate(glm::mat4(1.0f), translation) * 
+            rotation * 
+            glm::scale(glm::mat4(1.0f), scale);
+        glm::mat4 invMat = 
+            glm::scale(glm::mat4(1.0f), 1.0f / scale) * 
+            glm::transpose(rotation) * 
+            glm::translate(glm::mat4(1.0f), -translation);
+        return Transform{ mat, invMat };
+    }
+
+private:
+    std::vector<TransformKeyframe> m_Keyframes;
+};
+
 inline glm::vec3 TransformVector(const glm::mat4& mat, const glm::vec3 &vec)
 {
     return mat * glm::vec4(vec, 0.0f);
@@ -129,6 +230,19 @@ inline glm::vec3 TransformPoint(const glm::mat4& mat, const glm::vec3& point)
     return mat * glm::vec4(point, 1.0f);
 }
 
+// Removes the part of tangent along the unit normal. Falls back to an
+// arbitrary perpendicular direction when tangent is parallel to normal.
+inline glm::vec3 OrthogonalizeTangent(const glm::vec3& tangent, const glm::vec3& normal)
+{
+    auto t = tangent - normal * glm::dot(normal, tangent);
+    float length2 = glm::dot(t, t);
+    if (length2 > 1e-12f)
+        return t / sqrtf(length2);
+
+    auto axis = fabs(normal.x) < 0.9f ? glm::vec3{ 1.0f, 0.0f, 0.0f } : glm::vec3{ 0.0f, 1.0f, 0.0f };
+    return glm::normalize(glm::cross(normal, axis));
+}
+
 struct AABB
 {
     glm::vec3 Min{ std::numeric_limits<float>::max() };
@@ -172,6 +286,35 @@ struct AABB
         return true;
     }
 
+    float SurfaceArea() const
+    {
+        auto d = Max - Min;
+        if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f)
+            return 0.0f;
+        return 2.0f * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+
+    static AABB Intersect(const AABB& box1, const AABB& box2)
+    {
+        return AABB{
+            glm::max(box1.Min, box2.Min),
+            glm::min(box1.Max, box2.Max)
+        };
+    }
+
+    bool IsEmpty() const
+    {
+        return Min.x > Max.x || Min.y > Max.y || Min.z > Max.z;
+    }
+
+    static AABB Lerp(const AABB& box0, const AABB& box1, float t)
+    {
+        return AABB{
+            glm::mix(box0.Min, box1.Min, t),
+            glm::mix(box0.Max, box1.Max, t)
+        };
+    }
+
     int MaxExtent() const
     {
         auto extent = Max - Min;
@@ -3,129 +3,219 @@
 #include "Geometry.h"
 #include "Shape.h"
 #include "Math.h"
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
 
-class Material
+enum class MaterialType : uint32_t
 {
-public:
-    Material() = default;
-    virtual ~Material() = default;
-
-    virtual bool Scatter(const Ray& inRay, const SurfaceInteraction& intersection, glm::vec3& attenuation, Ray& outRay) const
-    {
-        return false;
-    }
+    Lambertian,
+    Metal,
+    Dielectric,
+    Emissive,
+    Count
+};
 
-    virtual void Emit(glm::vec3& emittedColor) const
-    {
-        emittedColor = glm::vec3(0.0f); // Default to no emission
-    }
+// Flat parameters of every material type. Shading reads these from the
+// scene's MaterialTable and switches on the type, so the branch only depends
+// on a small tag instead of a vtable pointer per hit.
+struct MaterialData
+{
+    MaterialType Type = MaterialType::Lambertian;
+    // Metal roughness or dielectric refraction index
+    float Param = 0.0f;
+    // Albedo, or the emitted color of emissive materials
+    glm::vec3 Color{ 0.0f };
 };
 
 // outRay = reflect ray + subsurface scattering ray
 // reflect ray = 0.0f
 // subsurface scattering ray = 1.0f (Randomness because of subsurface scattering)
-class LambertianMaterial : public Material
+inline bool ScatterLambertian(const MaterialData& material, const SurfaceInteraction& interaction, const glm::vec2& u, glm::vec3& attenuation, Ray& outRay)
 {
-public:
-    LambertianMaterial(const glm::vec3& albedo) : m_Albedo(albedo) {};
+    auto scatterDirection = interaction.Normal + SampleUniformSphere(u);
 
-    virtual bool Scatter(const Ray& inRay, const SurfaceInteraction& interaction, glm::vec3& attenuation, Ray& outRay) const override
+    auto& e = scatterDirection;
+    auto s = 1e-8;
+    if ((std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s))
     {
-        auto scatterDirection = interaction.Normal + RandomUnitVector();
-
-        auto& e = scatterDirection;
-        auto s = 1e-8;
-        if ((std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s))
-        {
-            scatterDirection = interaction.Normal;
-        }
-
-        outRay.Origin = interaction.Position;
-        outRay.Direction = glm::normalize(scatterDirection);
-
-        attenuation = m_Albedo;
-
-        return true;
+        scatterDirection = interaction.Normal;
     }
 
-private:
+    outRay.Origin = interaction.Position;
+    outRay.Direction = glm::normalize(scatterDirection);
 
-    glm::vec3 m_Albedo;
-};
+    attenuation = material.Color;
+
+    return true;
+}
 
 // outRay = reflect ray + subsurface scattering ray
 // reflect ray = 1.0f (randomness because of PBR roughness)
 // subsurface scattering ray = 0.0f
-class MetalMaterial : public Material
+inline bool ScatterMetal(const MaterialData& material, const Ray& inRay, const SurfaceInteraction& interaction, const glm::vec2& u, glm::vec3& attenuation, Ray& outRay)
+{
+    auto reflectedDir = glm::reflect(inRay.Direction, interaction.Normal);
+    reflectedDir = glm::normalize(reflectedDir) + material.Param * SampleUniformSphere(u);
+
+    outRay.Origin = interaction.Position;
+    outRay.Direction = glm::normalize(reflectedDir);
+
+    attenuation = material.Color;
+
+    return glm::dot(outRay.Direction, interaction.Normal) > 0.0f;
+}
+
+inline float FresnelReflectance(float cosine, float refractionIndex)
+{
+    // Use Schlick's approximation for reflectance.
+    auto r0 = (1 - refractionIndex) / (1 + refractionIndex);
+    r0 = r0*r0;
+    return r0 + (1-r0)*std::pow((1 - cosine),5);
+}
+
+inline bool ScatterDielectric(const MaterialData& material, const Ray& inRay, const SurfaceInteraction& interaction, float uc, glm::vec3& attenuation, Ray& outRay)
+{
+    attenuation = glm::vec3 { 1.0f, 1.0f, 1.0f };
+    float ri = interaction.IsFrontFace ? (1.0f / material.Param) : material.Param;
+
+    glm::vec3 unit_direction = inRay.Direction;
+    float cos_theta = std::fmin(glm::dot(-unit_direction, interaction.Normal), 1.0f);
+    float sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
+
+    bool cannot_refract = ri * sin_theta > 1.0;
+    glm::vec3 direction;
+
+    if (cannot_refract || FresnelReflectance(cos_theta, ri) > uc)
+        direction = glm::reflect(unit_direction, interaction.Normal);
+    else
+        direction = Reflect(unit_direction, interaction.Normal, ri);
+
+    outRay = Ray{ interaction.Position, direction };
+
+    return true;
+}
+
+// uc selects between lobes, u samples the scattered direction. Returns false
+// when the path ends, attenuation is then left as it was.
+inline bool ScatterMaterial(const MaterialData& material, const Ray& inRay, const SurfaceInteraction& interaction, float uc, const glm::vec2& u, glm::vec3& attenuation, Ray& outRay)
+{
+    switch (material.Type)
+    {
+    case MaterialType::Lambertian:  return ScatterLambertian(material, interaction, u, attenuation, outRay);
+    case MaterialType::Metal:       return ScatterMetal(material, inRay, interaction, u, attenuation, outRay);
+    case MaterialType::Dielectric:  return ScatterDielectric(material, inRay, interaction, uc, attenuation, outRay);
+    default:                        return false;
+    }
+}
+
+inline glm::vec3 EmitMaterial(const MaterialData& material)
+{
+    return material.Type == MaterialType::Emissive ? material.Color : glm::vec3(0.0f);
+}
+
+// Materials of a scene by ID. Entry 0 is a grey Lambertian that primitives
+// without a registered material fall back to.
+class MaterialTable
 {
 public:
-    MetalMaterial(const glm::vec3& albedo, float metallic=0.0f) : m_Albedo(albedo), m_Roughness(metallic) {}
+    constexpr static MaterialID defaultMaterialID = 0;
 
-    virtual bool Scatter(const Ray& inRay, const SurfaceInteraction& interaction, glm::vec3& attenuation, Ray& outRay) const override
+    MaterialTable()
     {
-        auto reflectedDir = glm::reflect(inRay.Direction, interaction.Normal);
-        reflectedDir = glm::normalize(reflectedDir) + m_Roughness * RandomUnitVector();
-        // reflectedDir = glm::normalize(reflectedDir);
+        MaterialData fallback;
+        fallback.Color = glm::vec3{ 0.5f };
+        m_Materials.push_back(fallback);
+    }
 
-        outRay.Origin = interaction.Position;
-        outRay.Direction = glm::normalize(reflectedDir);
+    MaterialID Add(const MaterialData& material)
+    {
+        if (m_Materials.size() > std::numeric_limits<MaterialID>::max())
+        {
+            std::cout << "Material table is full!" << std::endl;
+            return defaultMaterialID;
+        }
+        m_Materials.push_back(material);
+        return (MaterialID)(m_Materials.size() - 1);
+    }
 
-        attenuation = m_Albedo;
+    const MaterialData& operator[](MaterialID id) const { return m_Materials[id]; }
+    size_t GetCount() const { return m_Materials.size(); }
 
-        return glm::dot(outRay.Direction, interaction.Normal) > 0.0f;
+    // Orders by type first and by material within a type, sorting a batch of
+    // hits by this key shades each type in one run
+    uint32_t GetSortKey(MaterialID id) const
+    {
+        return ((uint32_t)m_Materials[id].Type << 16) | id;
     }
 
 private:
-    glm::vec3 m_Albedo;
-    float m_Roughness; // Fresnel reflectance
+    std::vector<MaterialData> m_Materials;
 };
 
-class DielectricMaterial : public Material
+// Materials are authored as objects, the scene flattens them into its
+// MaterialTable when it is built
+class Material
 {
 public:
-    DielectricMaterial(float refractionIndex) : m_RefractionIndex(refractionIndex) {};
+    virtual ~Material() = default;
 
-    virtual bool Scatter(const Ray& inRay, const SurfaceInteraction& interaction, glm::vec3& attenuation, Ray& outRay) const override
+    const MaterialData& GetData() const { return m_Data; }
+
+    bool Scatter(const Ray& inRay, const SurfaceInteraction& intersection, float uc, const glm::vec2& u, glm::vec3& attenuation, Ray& outRay) const
     {
-        attenuation = glm::vec3 { 1.0f, 1.0f, 1.0f };
-        float ri = interaction.IsFrontFace ? (1.0f / m_RefractionIndex) : m_RefractionIndex;
+        return ScatterMaterial(m_Data, inRay, intersection, uc, u, attenuation, outRay);
+    }
 
-        glm::vec3 unit_direction = inRay.Direction;
-        float cos_theta = std::fmin(glm::dot(-unit_direction, interaction.Normal), 1.0f);
-        float sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
+    void Emit(glm::vec3& emittedColor) const
+    {
+        emittedColor = EmitMaterial(m_Data);
+    }
 
-        bool cannot_refract = ri * sin_theta > 1.0;
-        glm::vec3 direction;
+protected:
+    Material() = default;
 
-        if (cannot_refract || this->fresnelReflectance(cos_theta, ri) > Random())
-            direction = glm::reflect(unit_direction, interaction.Normal);
-        else
-            direction = Reflect(unit_direction, interaction.Normal, ri);
+    MaterialData m_Data;
+};
 
-        outRay = Ray{ interaction.Position, direction };
+class LambertianMaterial : public Material
+{
+public:
+    LambertianMaterial(const glm::vec3& albedo)
+    {
+        m_Data.Type = MaterialType::Lambertian;
+        m_Data.Color = albedo;
+    }
+};
 
-        return true;
+class MetalMaterial : public Material
+{
+public:
+    MetalMaterial(const glm::vec3& albedo, float metallic=0.0f)
+    {
+        m_Data.Type = MaterialType::Metal;
+        m_Data.Color = albedo;
+        m_Data.Param = metallic;    // roughness of the reflection
     }
-private:
-    float m_RefractionIndex;
+};
 
-    static float fresnelReflectance(float cosine, float refractionIndex) {
-        // Use Schlick's approximation for reflectance.
-        auto r0 = (1 - refractionIndex) / (1 + refractionIndex);
-        r0 = r0*r0;
-        return r0 + (1-r0)*std::pow((1 - cosine),5);
+class DielectricMaterial : public Material
+{
+public:
+    DielectricMaterial(float refractionIndex)
+    {
+        m_Data.Type = MaterialType::Dielectric;
+        m_Data.Param = refractionIndex;
     }
 };
 
 class EmissiveMaterial : public Material
 {
 public:
-    EmissiveMaterial(const glm::vec3& color) : m_Color(color) {}
-
-    virtual void Emit(glm::vec3& emittedColor) const override
+    EmissiveMaterial(const glm::vec3& color)
     {
-        emittedColor = m_Color;
+        m_Data.Type = MaterialType::Emissive;
+        m_Data.Color = color;
     }
-private:
-    glm::vec3 m_Color;
-};
\ No newline at end of file
+};
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "Core/Core.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 
 inline float Random()
 {
@@ -25,6 +27,33 @@ inline glm::vec3 RandomUnitVector()
     }
 }
 
+// Maps a uniform sample in [0, 1)^2 to a point on the unit sphere
+inline glm::vec3 SampleUniformSphere(const glm::vec2& u)
+{
+    constexpr float twoPi = 6.28318530718f;
+    float z = 1.0f - 2.0f * u.x;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = twoPi * u.y;
+    return { r * std::cos(phi), r * std::sin(phi), z };
+}
+
+// Shirley-Chiu concentric mapping of [0, 1)^2 to the unit disk, written with
+// selects so it vectorizes inside ray generation loops
+inline void SampleUniformDiskConcentric(float u, float v, float& x, float& y)
+{
+    constexpr float piOver4 = 0.785398163397f;
+    constexpr float piOver2 = 1.57079632679f;
+    float ox = 2.0f * u - 1.0f;
+    float oy = 2.0f * v - 1.0f;
+    bool useX = std::fabs(ox) > std::fabs(oy);
+    float r = useX ? ox : oy;
+    float safeX = ox != 0.0f ? ox : 1.0f;
+    float safeY = oy != 0.0f ? oy : 1.0f;
+    float theta = useX ? piOver4 * (oy / safeX) : piOver2 - piOver4 * (ox / safeY);
+    x = r * std::cos(theta);
+    y = r * std::sin(theta);
+}
+
 inline float LengthSquared(const glm::vec3& v)
 {
     return glm::dot(v, v);
@@ -35,4 +64,44 @@ inline glm::vec3 Reflect(const glm::vec3& uv, const glm::vec3& n, float etai_ove
     glm::vec3 r_out_perp =  etai_over_etat * (uv + cos_theta * n);
     glm::vec3 r_out_parallel = -std::sqrt(std::fabs(1.0f - LengthSquared(r_out_perp))) * n;
     return r_out_perp + r_out_parallel;
+}
+
+// Octahedral unit vector encoding, two 16-bit snorm values packed in 32 bits.
+// The worst case error is about 0.005 degrees.
+inline uint32_t EncodeOctahedral(const glm::vec3& v)
+{
+    float l1 = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+    if (l1 == 0.0f)
+        return 0x7FFFu << 16;
+
+    float x = v.x / l1;
+    float y = v.y / l1;
+    // The lower hemisphere folds over the diagonals
+    if (v.z < 0.0f)
+    {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    auto quantize = [](float f) {
+        return (uint32_t)(uint16_t)(int16_t)std::lround(std::clamp(f, -1.0f, 1.0f) * 32767.0f);
+    };
+    return quantize(x) | (quantize(y) << 16);
+}
+
+inline glm::vec3 DecodeOctahedral(uint32_t encoded)
+{
+    float x = (int16_t)(encoded & 0xFFFFu) * (1.0f / 32767.0f);
+    float y = (int16_t)(encoded >> 16) * (1.0f / 32767.0f);
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0.0f)
+    {
+        float unfoldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float unfoldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = unfoldedX;
+        y = unfoldedY;
+    }
+    return glm::normalize(glm::vec3{ x, y, z });
 }
\ No newline at end of file
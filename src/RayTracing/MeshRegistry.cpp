@@ -0,0 +1,111 @@
+#include "MeshRegistry.h"
+
+#include <filesystem>
+
+InstancedMesh::InstancedMesh(std::shared_ptr<const Mesh> mesh, const BVHBuildOptions& options)
+    : m_Mesh(std::move(mesh))
+{
+    for (const auto& vertex : m_Mesh->GetVertices())
+        m_Bounds = AABB::Union(m_Bounds, vertex);
+
+    // Identity transforms, the leaves get world space records in object space
+    uint32_t count = (uint32_t)(m_Mesh->GetIndices().size() / 3);
+    std::vector<std::shared_ptr<SimplePrimitive>> triangles;
+    triangles.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+        triangles.push_back(std::make_shared<SimplePrimitive>(std::make_shared<MeshTriangle>(m_Mesh.get(), i), nullptr));
+    m_BVH = std::make_unique<BVH>(std::move(triangles), options);
+}
+
+InstancedMesh::InstancedMesh(std::shared_ptr<const QuantizedMesh> mesh)
+    : m_QuantizedMesh(std::move(mesh)), m_Bounds(m_QuantizedMesh->GetBounds())
+{
+}
+
+bool InstancedMesh::IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const
+{
+    HitRecord meshHit;
+    if (m_QuantizedMesh)
+    {
+        if (!m_QuantizedMesh->IntersectHit(ray, tMax, &meshHit))
+            return false;
+    }
+    else if (!m_BVH->IntersectHit(ray, tMax, &meshHit))
+        return false;
+
+    *hit = meshHit;
+    hit->ElementIndex = meshHit.PrimitiveIndex;
+    return true;
+}
+
+void InstancedMesh::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    HitRecord meshHit = hit;
+    meshHit.PrimitiveIndex = hit.ElementIndex;
+    if (m_QuantizedMesh)
+        m_QuantizedMesh->ComputeInteraction(ray, meshHit, intersect);
+    else
+        m_BVH->ComputeInteraction(ray, meshHit, intersect);
+}
+
+AABB InstancedMesh::GetAABB(Transform* transform) const
+{
+    AABB bounds = m_Bounds;
+    return bounds.TransformAndBound(transform);
+}
+
+MeshRegistry::Entry& MeshRegistry::GetEntry(const std::string& path)
+{
+    // Different spellings of the same file share the entry
+    std::error_code error;
+    auto key = std::filesystem::weakly_canonical(path, error).string();
+    if (error)
+        key = path;
+    return m_Entries[key];
+}
+
+std::shared_ptr<const Mesh> MeshRegistry::GetMesh(const std::string& path)
+{
+    auto& entry = GetEntry(path);
+    if (!entry.Source)
+        entry.Source = std::make_shared<Mesh>(path);
+    return entry.Source;
+}
+
+std::shared_ptr<const QuantizedMesh> MeshRegistry::GetQuantizedMesh(const std::string& path)
+{
+    auto& entry = GetEntry(path);
+    if (!entry.Quantized)
+    {
+        if (entry.Source)
+            entry.Quantized = std::make_shared<QuantizedMesh>(*entry.Source);
+        else
+            entry.Quantized = std::make_shared<QuantizedMesh>(path);
+    }
+    return entry.Quantized;
+}
+
+std::shared_ptr<InstancedMesh> MeshRegistry::GetInstancedMesh(const std::string& path)
+{
+    auto& entry = GetEntry(path);
+    if (!entry.Instanced)
+    {
+        if (m_CompressInstances)
+            entry.Instanced = std::make_shared<InstancedMesh>(GetQuantizedMesh(path));
+        else
+            entry.Instanced = std::make_shared<InstancedMesh>(GetMesh(path), m_Options);
+    }
+    return entry.Instanced;
+}
+
+std::shared_ptr<SimplePrimitive> MeshRegistry::CreateInstance(
+    const std::string& path,
+    std::shared_ptr<Material> material,
+    const glm::vec3& scale, 
+    const glm::vec3& eulerAngles, 
+    const glm::vec3& translation)
+{
+    auto instance = std::make_shared<SimplePrimitive>(GetInstancedMesh(path), std::move(material));
+    instance->SetTransform(scale, eulerAngles, translation);
+    return instance;
+}
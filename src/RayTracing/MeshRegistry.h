@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BVH.h"
+#include "QuantizedMesh.h"
+#include <string>
+#include <unordered_map>
+
+// Places a shared mesh through its own object space BVH, the triangles are
+// built once per mesh no matter how many primitives use the shape. Quantized
+// meshes bring their own BVH over triangle ranges.
+class InstancedMesh : public Shape
+{
+public:
+    InstancedMesh(std::shared_ptr<const Mesh> mesh, const BVHBuildOptions& options);
+    explicit InstancedMesh(std::shared_ptr<const QuantizedMesh> mesh);
+
+    virtual ShapeType GetType() const override  { return ShapeType::InstancedMesh; }
+
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const override;
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const override;
+    virtual AABB GetAABB(Transform* transform) const override;
+
+private:
+    // One of the two is set. Float meshes get a BVH of triangle primitives
+    // pointing into the mesh.
+    std::shared_ptr<const Mesh> m_Mesh;
+    std::unique_ptr<BVH> m_BVH;
+    std::shared_ptr<const QuantizedMesh> m_QuantizedMesh;
+    AABB m_Bounds;
+};
+
+// One copy of every mesh file, and of its instancing BVH, per unique path
+class MeshRegistry
+{
+public:
+    explicit MeshRegistry(const BVHBuildOptions& options = BVHBuildOptions())
+        : m_Options(options) {}
+
+    // Instanced meshes created afterwards use QuantizedMesh storage, at the
+    // cost of 16-bit positions and UVs. Off by default.
+    void SetCompressInstances(bool compress)    { m_CompressInstances = compress; }
+    bool GetCompressInstances() const           { return m_CompressInstances; }
+
+    std::shared_ptr<const Mesh> GetMesh(const std::string& path);
+    // Quantized straight from the file one attribute at a time when the float
+    // mesh was not requested, so the float copy never exists in full
+    std::shared_ptr<const QuantizedMesh> GetQuantizedMesh(const std::string& path);
+    // Built on first use, shared by every placement of the mesh
+    std::shared_ptr<InstancedMesh> GetInstancedMesh(const std::string& path);
+
+    // Placement of the mesh as a single primitive, its memory does not grow
+    // with the triangle count
+    std::shared_ptr<SimplePrimitive> CreateInstance(
+        const std::string& path,
+        std::shared_ptr<Material> material,
+        const glm::vec3& scale, 
+        const glm::vec3& eulerAngles, 
+        const glm::vec3& translation);
+
+    size_t GetMeshCount() const                 { return m_Entries.size(); }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Mesh> Source;
+        std::shared_ptr<const QuantizedMesh> Quantized;
+        std::shared_ptr<InstancedMesh> Instanced;
+    };
+
+    Entry& GetEntry(const std::string& path);
+
+    BVHBuildOptions m_Options;
+    bool m_CompressInstances = false;
+    std::unordered_map<std::string, Entry> m_Entries;
+};
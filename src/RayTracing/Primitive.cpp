@@ -1,66 +1,141 @@
 #include "Primitive.h"
 
-void SimplePrimitive::Intersect(const Ray& ray, SurfaceInteraction* intersect)
+// Number of shutter samples used to fit linear motion bounds
+constexpr static int motionBoundSamples = 32;
+
+static Ray ToObjectSpace(const Ray& ray, const Transform& transform)
 {
     Ray rayLocal;
-    rayLocal.Origin = TransformPoint(m_Transform.GetInvMat(), ray.Origin);
-    rayLocal.Direction = TransformNormal(m_Transform.GetMat(), ray.Direction);
-    m_Shape->Intersect(rayLocal, intersect);
-    intersect->Position = TransformPoint(m_Transform.GetMat(), intersect->Position);
-    intersect->Normal = TransformNormal(m_Transform.GetInvMat(), intersect->Normal);
-    intersect->Material = m_Material.get();
+    rayLocal.Origin = TransformPoint(transform.GetInvMat(), ray.Origin);
+    rayLocal.Direction = TransformNormal(transform.GetMat(), ray.Direction);
+    rayLocal.Time = ray.Time;
+    return rayLocal;
 }
 
-static bool genNormal = false;
+void SimplePrimitive::Intersect(const Ray& ray, SurfaceInteraction* intersect)
+{
+    HitRecord hit;
+    if (IntersectHit(ray, std::numeric_limits<float>::max(), &hit))
+        ComputeInteraction(ray, hit, intersect);
+    else
+        intersect->HasIntersection = false;
+}
 
-TriangleList::TriangleList(const Mesh& mesh, std::shared_ptr<Material> material)
-    : m_Material(material)
+bool SimplePrimitive::IntersectHit(const Ray& ray, float tMax, HitRecord* hit)
 {
-    const auto& vertices = mesh.GetVertices();
-    const auto& normals = mesh.GetNormals();
-    const auto& indices = mesh.GetIndices();
+    auto transform = GetTransformAt(ray.Time);
+    auto rayLocal = ToObjectSpace(ray, transform);
 
-    if (indices.size() % 3 != 0)
-        std::cout << "Indice size is not 3 * n" << std::endl;
-    auto count = indices.size() / 3;
-    m_TriangleList.reserve(count);
+    // The object space ray is normalized, its t is the world space one scaled
+    // by the object space length of the world direction. The clip only culls,
+    // the world t below decides.
+    float localTMax = std::numeric_limits<float>::max();
+    if (tMax < std::numeric_limits<float>::max())
+        localTMax = tMax * glm::length(glm::mat3(transform.GetInvMat()) * ray.Direction);
+    HitRecord localHit;
+    if (!m_Shape->IntersectHit(rayLocal, localTMax, &localHit))
+        return false;
+
+    auto position = TransformPoint(transform.GetMat(), rayLocal.Origin + rayLocal.Direction * localHit.T);
+    float t = glm::length(position - ray.Origin) / glm::length(ray.Direction);
+    if (t >= tMax)
+        return false;
+
+    *hit = localHit;
+    hit->T = t;
+    return true;
+}
+
+void SimplePrimitive::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect)
+{
+    auto transform = GetTransformAt(ray.Time);
+    auto rayLocal = ToObjectSpace(ray, transform);
 
-    for (int i = 0; i < count; i++)
+    HitRecord localHit = hit;
+    auto localPosition = TransformPoint(transform.GetInvMat(), ray.Origin + ray.Direction * hit.T);
+    localHit.T = glm::dot(localPosition - rayLocal.Origin, rayLocal.Direction);
+
+    m_Shape->ComputeInteraction(rayLocal, localHit, intersect);
+    intersect->Position = TransformPoint(transform.GetMat(), intersect->Position);
+    intersect->Normal = TransformNormal(transform.GetInvMat(), intersect->Normal);
+    intersect->Tangent = OrthogonalizeTangent(TransformVector(transform.GetMat(), intersect->Tangent), intersect->Normal);
+    intersect->MaterialIndex = m_MaterialID;
+}
+
+AABB SimplePrimitive::GetAABB()
+{
+    if (!m_Motion.IsAnimated())
+        return m_Shape->GetAABB(&m_Transform);
+
+    AABB bounds0, bounds1;
+    GetLinearBounds(&bounds0, &bounds1);
+    return AABB::Union(bounds0, bounds1);
+}
+
+AABB SimplePrimitive::GetClippedAABB(const AABB& clip)
+{
+    if (m_Motion.IsAnimated())
+        return AABB::Intersect(GetAABB(), clip);
+
+    return m_Shape->GetClippedAABB(&m_Transform, clip);
+}
+
+void SimplePrimitive::GetLinearBounds(AABB* bounds0, AABB* bounds1)
+{
+    if (!m_Motion.IsAnimated())
     {
-        auto i0 = indices[i * 3 + 0];
-        auto i1 = indices[i * 3 + 1];
-        auto i2 = indices[i * 3 + 2];
-        glm::vec3 normal;
-        normal = glm::normalize(glm::cross(vertices[i1]-vertices[i0], vertices[i2]-vertices[i0]));
-        if (genNormal || normals.size() == 0)
-        {
-            m_TriangleList.push_back(Triangle(
-                vertices[i0] * 1.0f,
-                vertices[i1] * 1.0f,
-                vertices[i2] * 1.0f,
-                normal,
-                normal,
-                normal,
-                glm::vec2{ 0.0f },
-                glm::vec2{ 0.0f },
-                glm::vec2{ 0.0f } )
-            );
-        }
-        else
-        {
-            m_TriangleList.push_back(Triangle(
-                vertices[i0] * 1.0f,
-                vertices[i1] * 1.0f,
-                vertices[i2] * 1.0f,
-                normals[i0],
-                normals[i1],
-                normals[i2],
-                glm::vec2{ 0.0f },
-                glm::vec2{ 0.0f },
-                glm::vec2{ 0.0f } )
-            );
-        }
+        *bounds0 = *bounds1 = m_Shape->GetAABB(&m_Transform);
+        return;
     }
+
+    auto boundsAt = [this](float time) {
+        auto transform = m_Motion.Interpolate(time);
+        return m_Shape->GetAABB(&transform);
+    };
+
+    std::vector<float> times;
+    for (int i = 0; i <= motionBoundSamples; i++)
+        times.push_back((float)i / motionBoundSamples);
+    for (const auto& keyframe : m_Motion.GetKeyframes())
+        if (keyframe.Time > 0.0f && keyframe.Time < 1.0f)
+            times.push_back(keyframe.Time);
+
+    *bounds0 = boundsAt(0.0f);
+    *bounds1 = boundsAt(1.0f);
+
+    // Push both end boxes out until the interpolated box contains every sample,
+    // shifting both ends by the same amount moves the whole lerp by that amount
+    for (float t : times)
+    {
+        auto sample = boundsAt(t);
+        auto lerped = AABB::Lerp(*bounds0, *bounds1, t);
+        auto minDeficit = glm::max(lerped.Min - sample.Min, glm::vec3{ 0.0f });
+        auto maxDeficit = glm::max(sample.Max - lerped.Max, glm::vec3{ 0.0f });
+        bounds0->Min -= minDeficit;
+        bounds1->Min -= minDeficit;
+        bounds0->Max += maxDeficit;
+        bounds1->Max += maxDeficit;
+    }
+
+    // Rotation can bulge between samples, pad by a fraction of the extent
+    auto pad = (glm::max(bounds0->Max - bounds0->Min, bounds1->Max - bounds1->Min)) * (1.0f / motionBoundSamples);
+    bounds0->Min -= pad;
+    bounds1->Min -= pad;
+    bounds0->Max += pad;
+    bounds1->Max += pad;
+}
+
+TriangleList::TriangleList(std::shared_ptr<const Mesh> mesh, std::shared_ptr<Material> material)
+    : m_Mesh(std::move(mesh)), m_Material(material)
+{
+    const auto& indices = m_Mesh->GetIndices();
+    if (indices.size() % 3 != 0)
+        std::cout << "Indice size is not 3 * n" << std::endl;
+
+    auto count = (uint32_t)(indices.size() / 3);
+    m_TriangleList.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+        m_TriangleList.emplace_back(m_Mesh.get(), i);
 }
 
 void TriangleList::Intersect(const Ray& ray, SurfaceInteraction* intersect)
@@ -68,39 +143,35 @@ void TriangleList::Intersect(const Ray& ray, SurfaceInteraction* intersect)
     Ray rayLocal;
     rayLocal.Origin = TransformPoint(m_Transform.GetInvMat(), ray.Origin);
     rayLocal.Direction = TransformNormal(m_Transform.GetMat(), ray.Direction);
+    rayLocal.Time = ray.Time;
 
-    float minDistance = std::numeric_limits<float>::max();
-    int minIndex = -1;
-    SurfaceInteraction minSurfaceInteraction;
-	for (uint32_t i = 0; i < m_TriangleList.size(); i++)
-	{
-        auto& triangle = m_TriangleList[i];
-		SurfaceInteraction si;
-		triangle.Intersect(rayLocal, &si);
-		if (si.HasIntersection)
-		{
-            si.Position = TransformPoint(m_Transform.GetMat(), si.Position);
-            
-            auto disVec = ray.Origin - si.Position;
-            auto distance2 = glm::dot(disVec, disVec);
-			si.Normal = TransformNormal(m_Transform.GetInvMat(), si.Normal);
-			si.Material = m_Material.get();
-            if (distance2 < minDistance)
-            {
-                minDistance = distance2;
-                minIndex = i;
-                minSurfaceInteraction = si;
-            }
-		}
-	}
+    // The object space ray is shared by all triangles, so hits compare in its
+    // t and the shear of the watertight test is set up once
+    RayShear shear(rayLocal.Direction);
+    HitRecord closest;
+    bool hasHit = false;
+    for (uint32_t i = 0; i < m_TriangleList.size(); i++)
+    {
+        HitRecord hit;
+        if (m_TriangleList[i].IntersectHit(rayLocal, shear, closest.T, &hit))
+        {
+            closest = hit;
+            closest.PrimitiveIndex = i;
+            hasHit = true;
+        }
+    }
 
-    if (minIndex >= 0)
+    if (!hasHit)
     {
-        *intersect = minSurfaceInteraction;
+        intersect->HasIntersection = false;
         return;
     }
 
-    intersect->HasIntersection = false; 
+    m_TriangleList[closest.PrimitiveIndex].ComputeInteraction(rayLocal, closest, intersect);
+    intersect->Position = TransformPoint(m_Transform.GetMat(), intersect->Position);
+    intersect->Normal = TransformNormal(m_Transform.GetInvMat(), intersect->Normal);
+    intersect->Tangent = OrthogonalizeTangent(TransformVector(m_Transform.GetMat(), intersect->Tangent), intersect->Normal);
+    intersect->MaterialIndex = m_MaterialID;
 }
 
 void PrimitiveList::Intersect(const Ray& ray, SurfaceInteraction* intersect)
@@ -132,18 +203,37 @@ void PrimitiveList::Intersect(const Ray& ray, SurfaceInteraction* intersect)
     intersect->HasIntersection = false;
 }
 
-std::vector<std::shared_ptr<SimplePrimitive>> TriangleList::GetPrimitives() const
+std::vector<std::shared_ptr<SimplePrimitive>> TriangleList::GetPrimitives()
 {
-    std::vector<std::shared_ptr<SimplePrimitive>> primitives;
-    primitives.reserve(m_TriangleList.size());
-    for (const auto& primitive : m_TriangleList)
+    if (m_Primitives.empty())
     {
-        primitives.push_back(std::make_shared<SimplePrimitive>(
-            std::make_shared<Triangle>(primitive), 
-            m_Material,
-            m_Transform
-        ));
+        m_Primitives.reserve(m_TriangleList.size());
+        for (const auto& primitive : m_TriangleList)
+        {
+            m_Primitives.push_back(std::make_shared<SimplePrimitive>(
+                std::make_shared<MeshTriangle>(primitive), 
+                m_Material,
+                m_Transform
+            ));
+            m_Primitives.back()->SetMaterialID(m_MaterialID);
+        }
     }
 
-    return primitives;
+    return m_Primitives;
+}
+
+void TriangleList::AddMotionKeyframe(
+    float time,
+    const glm::vec3& scale, 
+    const glm::vec3& eulerAngles, 
+    const glm::vec3& translation)
+{
+    for (auto& primitive : GetPrimitives())
+        primitive->AddMotionKeyframe(time, scale, eulerAngles, translation);
+}
+
+void TriangleList::UpdatePrimitiveTransforms()
+{
+    for (auto& primitive : m_Primitives)
+        primitive->SetTransform(m_Transform);
 }
\ No newline at end of file
@@ -18,8 +18,15 @@ public:
     SimplePrimitive(std::shared_ptr<Shape> shape, std::shared_ptr<Material> material, Transform transform=Transform())
         : m_Shape(shape), m_Material(material), m_Transform(transform) {}
     virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) override;
+    // Closest hit in [shapeTMin, tMax), hit->T is along the world space ray
+    bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit);
+    // World space surface at a hit found by IntersectHit with the same ray
+    void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect);
     Shape& GetShape() { return *m_Shape; }
     Material& GetMaterial()                     { return *m_Material; }
+    // Set when the scene registers the material in its MaterialTable
+    void SetMaterialID(MaterialID id)           { m_MaterialID = id; }
+    MaterialID GetMaterialID() const            { return m_MaterialID; }
 
     Transform GetTransform() const              { return m_Transform; }
     void SetTransform(const Transform& trans)   { m_Transform = trans; }
@@ -32,14 +39,38 @@ public:
         m_Transform.Set(scale, glm::radians(eulerAngles), translation);
     }
 
-    AABB GetAABB()
+    // Keyframes override the static transform while the primitive is animated
+    void AddMotionKeyframe(
+        float time,
+        const glm::vec3& scale, 
+        const glm::vec3& eulerAngles, 
+        const glm::vec3& translation)
     {
-        return m_Shape->GetAABB(&m_Transform);
+        m_Motion.AddKeyframe(time, scale, glm::radians(eulerAngles), translation);
     }
+    void ClearMotion()                          { m_Motion.Clear(); }
+    bool IsAnimated() const                     { return m_Motion.IsAnimated(); }
+
+    // Bounds over the whole shutter interval
+    AABB GetAABB();
+
+    // Bounds of the part of the primitive inside clip
+    AABB GetClippedAABB(const AABB& clip);
+
+    // Bounds at shutter open and close, every lerp between them contains the
+    // primitive at that time
+    void GetLinearBounds(AABB* bounds0, AABB* bounds1);
 private:
+    Transform GetTransformAt(float time) const
+    {
+        return m_Motion.IsAnimated() ? m_Motion.Interpolate(time) : m_Transform;
+    }
+
     std::shared_ptr<Shape> m_Shape;
     Transform m_Transform;
+    MotionTransform m_Motion;
     std::shared_ptr<Material> m_Material;
+    MaterialID m_MaterialID = MaterialTable::defaultMaterialID;
 };
 
 class PrimitiveList : public Primitive
@@ -57,14 +88,30 @@ private:
     std::vector<std::shared_ptr<Primitive>> m_List;
 };
 
+// Triangles reference the shared mesh arrays, placing a mesh twice only
+// duplicates the per-triangle primitives. See MeshRegistry for placements
+// that share those too.
 class TriangleList : public Primitive
 {
 public:
-    TriangleList(const Mesh& mesh, std::shared_ptr<Material> material);
+    TriangleList(std::shared_ptr<const Mesh> mesh, std::shared_ptr<Material> material);
     virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) override;
     Transform GetTransform() const              { return m_Transform; }
-    std::vector<std::shared_ptr<SimplePrimitive>> GetPrimitives() const;
-    void SetTransform(const Transform& trans)   { m_Transform = trans; }
+    // The returned primitives follow later SetTransform calls, refit the BVH
+    // afterwards. They point into the mesh, keep it alive while they are used.
+    std::vector<std::shared_ptr<SimplePrimitive>> GetPrimitives();
+    // Also applies to the primitives returned by GetPrimitives
+    void SetMaterialID(MaterialID id)
+    {
+        m_MaterialID = id;
+        for (auto& primitive : m_Primitives)
+            primitive->SetMaterialID(id);
+    }
+    void SetTransform(const Transform& trans)   
+    { 
+        m_Transform = trans; 
+        UpdatePrimitiveTransforms();
+    }
     void SetTransform(
         const glm::vec3& scale, 
         const glm::vec3& eulerAngles, 
@@ -72,9 +119,22 @@ public:
     { 
         m_Transform = Transform(); 
         m_Transform.Set(scale, glm::radians(eulerAngles), translation);
+        UpdatePrimitiveTransforms();
     }
+    // Applies to the primitives returned by GetPrimitives
+    void AddMotionKeyframe(
+        float time,
+        const glm::vec3& scale, 
+        const glm::vec3& eulerAngles, 
+        const glm::vec3& translation);
 private:
-    std::vector<Triangle>       m_TriangleList;
+    void UpdatePrimitiveTransforms();
+
+    std::shared_ptr<const Mesh> m_Mesh;
+    std::vector<MeshTriangle>   m_TriangleList;
     std::shared_ptr<Material>   m_Material;
+    MaterialID                  m_MaterialID = MaterialTable::defaultMaterialID;
     Transform                   m_Transform;
+
+    std::vector<std::shared_ptr<SimplePrimitive>> m_Primitives;
 };
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include "QuantizedMesh.h"
+#include "RenderStats.h"
+
+constexpr static float quantizationSteps = 65535.0f;
+
+// Same limits as the scene BVH
+constexpr static int splitBuckets = 16;
+constexpr static int maxBuildDepth = 56;
+// Ranges this small are always leaves. Splitting them further lowers the SAH
+// cost a little, but nodes would then take more memory than the triangles.
+constexpr static uint32_t maxTrianglesInLeaf = 4;
+
+static uint16_t Quantize(float value, float min, float scale)
+{
+    if (scale == 0.0f)
+        return 0;
+    return (uint16_t)std::clamp(std::lround((value - min) / scale), 0l, (long)quantizationSteps);
+}
+
+static glm::vec3 Centroid(const AABB& bounds)
+{
+    return .5f * bounds.Min + .5f * bounds.Max;
+}
+
+QuantizedMesh::QuantizedMesh(const std::string& plyFilePath)
+{
+    {
+        Mesh positions(plyFilePath, MeshPositions);
+        QuantizePositions(positions.GetVertices());
+    }
+    {
+        Mesh attributes(plyFilePath, MeshNormals | MeshTexCoords);
+        QuantizeAttributes(attributes.GetNormals(), attributes.GetTexCoords());
+    }
+    {
+        Mesh indices(plyFilePath, MeshIndices);
+        m_Indices = indices.ReleaseIndices();
+    }
+    BuildBVH();
+}
+
+QuantizedMesh::QuantizedMesh(const Mesh& mesh)
+    : m_Indices(mesh.GetIndices())
+{
+    QuantizePositions(mesh.GetVertices());
+    QuantizeAttributes(mesh.GetNormals(), mesh.GetTexCoords());
+    BuildBVH();
+}
+
+void QuantizedMesh::QuantizePositions(const std::vector<glm::vec3>& vertices)
+{
+    for (const auto& vertex : vertices)
+        m_Bounds = AABB::Union(m_Bounds, vertex);
+    m_PositionMin = m_Bounds.Min;
+    m_PositionScale = (m_Bounds.Max - m_Bounds.Min) / quantizationSteps;
+
+    m_Positions.reserve(vertices.size());
+    for (const auto& vertex : vertices)
+    {
+        m_Positions.push_back({
+            Quantize(vertex.x, m_PositionMin.x, m_PositionScale.x),
+            Quantize(vertex.y, m_PositionMin.y, m_PositionScale.y),
+            Quantize(vertex.z, m_PositionMin.z, m_PositionScale.z)
+        });
+    }
+
+    // Bounds now hold the decoded extremes, which round to the original ones
+    m_Bounds = AABB{};
+    for (uint32_t i = 0; i < (uint32_t)m_Positions.size(); i++)
+        m_Bounds = AABB::Union(m_Bounds, GetPosition(i));
+}
+
+void QuantizedMesh::QuantizeAttributes(const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& texCoords)
+{
+    if (normals.size() == m_Positions.size())
+    {
+        m_Normals.reserve(normals.size());
+        for (const auto& normal : normals)
+            m_Normals.push_back(EncodeOctahedral(normal));
+    }
+
+    if (texCoords.size() == m_Positions.size())
+    {
+        glm::vec2 uvMax{ std::numeric_limits<float>::lowest() };
+        m_UVMin = glm::vec2{ std::numeric_limits<float>::max() };
+        for (const auto& uv : texCoords)
+        {
+            m_UVMin = glm::min(m_UVMin, uv);
+            uvMax = glm::max(uvMax, uv);
+        }
+        m_UVScale = (uvMax - m_UVMin) / quantizationSteps;
+
+        m_UVs.reserve(texCoords.size());
+        for (const auto& uv : texCoords)
+            m_UVs.push_back({ Quantize(uv.x, m_UVMin.x, m_UVScale.x), Quantize(uv.y, m_UVMin.y, m_UVScale.y) });
+    }
+}
+
+size_t QuantizedMesh::GetMemorySize() const
+{
+    return m_Positions.size() * sizeof(QuantizedPosition) +
+        m_Normals.size() * sizeof(uint32_t) +
+        m_UVs.size() * sizeof(QuantizedUV) +
+        m_Indices.size() * sizeof(uint32_t) +
+        m_Nodes.size() * sizeof(LinearBVHNode);
+}
+
+AABB QuantizedMesh::GetTriangleBounds(uint32_t triangle) const
+{
+    const uint32_t* indices = GetTriangle(triangle);
+    AABB bounds;
+    for (int i = 0; i < 3; i++)
+        bounds = AABB::Union(bounds, GetPosition(indices[i]));
+    return bounds;
+}
+
+void QuantizedMesh::GetRangeBounds(uint32_t first, uint32_t count, AABB* bounds, AABB* centroidBounds) const
+{
+    *bounds = *centroidBounds = AABB{};
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        AABB triangleBounds = GetTriangleBounds(i);
+        *bounds = AABB::Union(*bounds, triangleBounds);
+        *centroidBounds = AABB::Union(*centroidBounds, Centroid(triangleBounds));
+    }
+}
+
+void QuantizedMesh::SwapTriangles(uint32_t a, uint32_t b)
+{
+    for (int i = 0; i < 3; i++)
+        std::swap(m_Indices[3 * a + i], m_Indices[3 * b + i]);
+}
+
+void QuantizedMesh::BuildBVH()
+{
+    m_Nodes.clear();
+    if (GetTriangleCount() == 0)
+        return;
+
+    AABB bounds, centroidBounds;
+    GetRangeBounds(0, GetTriangleCount(), &bounds, &centroidBounds);
+    BuildNode(0, GetTriangleCount(), bounds, centroidBounds, 0);
+    m_Nodes.shrink_to_fit();
+}
+
+// Binned SAH over triangle centroids. Triangle bounds are decoded again on
+// every level instead of being kept, so the build needs no memory per
+// triangle beyond the index triples it partitions in place. The bins also
+// give the exact bounds of both children, each level decodes the triangles
+// of a node twice, once to bin and once to partition.
+void QuantizedMesh::BuildNode(uint32_t first, uint32_t count, const AABB& bounds, const AABB& centroidBounds, int depth)
+{
+    uint32_t nodeIndex = (uint32_t)m_Nodes.size();
+    m_Nodes.emplace_back();
+
+    auto makeLeaf = [&]()
+    {
+        if (count > std::numeric_limits<uint16_t>::max())
+            std::cout << "QuantizedMesh BVH leaf too large, " << count << " triangles" << std::endl;
+        auto& node = m_Nodes[nodeIndex];
+        node.Bounds = bounds;
+        node.PrimitivesOffset = (int)first;
+        node.nPrimitives = (uint16_t)count;
+    };
+
+    if (count <= maxTrianglesInLeaf || depth == maxBuildDepth)
+    {
+        makeLeaf();
+        return;
+    }
+
+    // All three axes are binned in one pass over the triangles
+    struct Bucket
+    {
+        uint32_t Count = 0;
+        AABB Bounds;
+        AABB CentroidBounds;
+    };
+    Bucket buckets[3][splitBuckets];
+    glm::vec3 centroidExtent = centroidBounds.Max - centroidBounds.Min;
+    glm::vec3 bucketScale;
+    for (int axis = 0; axis < 3; axis++)
+        bucketScale[axis] = centroidExtent[axis] > 0.0f ? splitBuckets / centroidExtent[axis] : 0.0f;
+
+    auto bucketOf = [&](float centroid, int axis)
+    {
+        int b = (int)((centroid - centroidBounds.Min[axis]) * bucketScale[axis]);
+        return std::clamp(b, 0, splitBuckets - 1);
+    };
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        AABB triangleBounds = GetTriangleBounds(i);
+        glm::vec3 centroid = Centroid(triangleBounds);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (bucketScale[axis] == 0.0f)
+                continue;
+            auto& bucket = buckets[axis][bucketOf(centroid[axis], axis)];
+            bucket.Count++;
+            bucket.Bounds = AABB::Union(bucket.Bounds, triangleBounds);
+            bucket.CentroidBounds = AABB::Union(bucket.CentroidBounds, centroid);
+        }
+    }
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1, bestBucket = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (bucketScale[axis] == 0.0f)
+            continue;
+
+        // Right side areas and counts for a split after bucket b
+        float rightArea[splitBuckets];
+        uint32_t rightCount[splitBuckets];
+        AABB right;
+        uint32_t count1 = 0;
+        for (int b = splitBuckets - 1; b > 0; b--)
+        {
+            right = AABB::Union(right, buckets[axis][b].Bounds);
+            count1 += buckets[axis][b].Count;
+            rightArea[b - 1] = right.SurfaceArea();
+            rightCount[b - 1] = count1;
+        }
+
+        AABB left;
+        uint32_t count0 = 0;
+        for (int b = 0; b < splitBuckets - 1; b++)
+        {
+            left = AABB::Union(left, buckets[axis][b].Bounds);
+            count0 += buckets[axis][b].Count;
+            if (count0 == 0 || rightCount[b] == 0)
+                continue;
+            float cost = count0 * left.SurfaceArea() + rightCount[b] * rightArea[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBucket = b;
+            }
+        }
+    }
+
+    uint32_t mid;
+    AABB childBounds[2], childCentroidBounds[2];
+    if (bestAxis < 0)
+    {
+        // Every centroid coincides, halve the range to keep leaves small
+        bestAxis = 0;
+        mid = first + count / 2;
+        GetRangeBounds(first, mid - first, &childBounds[0], &childCentroidBounds[0]);
+        GetRangeBounds(mid, first + count - mid, &childBounds[1], &childCentroidBounds[1]);
+    }
+    else
+    {
+        for (int b = 0; b < splitBuckets; b++)
+        {
+            int side = b <= bestBucket ? 0 : 1;
+            childBounds[side] = AABB::Union(childBounds[side], buckets[bestAxis][b].Bounds);
+            childCentroidBounds[side] = AABB::Union(childCentroidBounds[side], buckets[bestAxis][b].CentroidBounds);
+        }
+
+        // Partition the index triples in place, only the split axis is decoded
+        uint32_t left = first, right = first + count;
+        while (left < right)
+        {
+            const uint32_t* indices = GetTriangle(left);
+            float minValue = std::numeric_limits<float>::max();
+            float maxValue = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < 3; i++)
+            {
+                float value = GetPosition(indices[i])[bestAxis];
+                minValue = std::min(minValue, value);
+                maxValue = std::max(maxValue, value);
+            }
+
+            if (bucketOf(.5f * minValue + .5f * maxValue, bestAxis) <= bestBucket)
+                left++;
+            else
+                SwapTriangles(left, --right);
+        }
+        mid = left;
+    }
+
+    BuildNode(first, mid - first, childBounds[0], childCentroidBounds[0], depth + 1);
+    m_Nodes[nodeIndex].SecondChildOffset = (int)m_Nodes.size();
+    BuildNode(mid, first + count - mid, childBounds[1], childCentroidBounds[1], depth + 1);
+
+    auto& node = m_Nodes[nodeIndex];
+    node.Bounds = bounds;
+    node.nPrimitives = 0;
+    node.axis = (uint8_t)bestAxis;
+}
+
+// Follows BVH::IntersectLinear, with the leaf kernel decoding the triangles
+bool QuantizedMesh::IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const
+{
+    if (m_Nodes.empty())
+        return false;
+
+    glm::vec3 invDir(1 / ray.Direction.x, 1 / ray.Direction.y, 1 / ray.Direction.z);
+    int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+
+    LeafRay leafRay(ray);
+    float tMin = shapeTMin * leafRay.InvDirLength;
+    HitRecord closest;
+    closest.T = tMax;
+    bool found = false;
+    uint32_t nodesVisited = 0, triangleTests = 0;
+
+    while (true) {
+        const LinearBVHNode *node = &m_Nodes[currentNodeIndex];
+        nodesVisited++;
+        if (node->Bounds.IntersectP(ray)) {
+            if (node->nPrimitives > 0) {
+                triangleTests += node->nPrimitives;
+                for (uint32_t i = node->PrimitivesOffset; i < node->PrimitivesOffset + node->nPrimitives; i++)
+                {
+                    const uint32_t* indices = GetTriangle(i);
+                    float t, b1, b2;
+                    if (!IntersectTriangleWatertight(leafRay, leafRay.Shear, GetPosition(indices[0]), GetPosition(indices[1]), GetPosition(indices[2]),
+                        tMin, closest.T, &t, &b1, &b2))
+                        continue;
+
+                    closest.T = t;
+                    closest.PrimitiveIndex = i;
+                    closest.B1 = b1;
+                    closest.B2 = b2;
+                    found = true;
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Near child first, the first child holds the lower centroids
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->SecondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->SecondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    RENDER_STAT_ADD(NodesVisited, nodesVisited);
+    RENDER_STAT_ADD(PrimitiveTests, triangleTests);
+
+    if (!found)
+        return false;
+
+    *hit = closest;
+    return true;
+}
+
+void QuantizedMesh::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    const uint32_t* indices = GetTriangle(hit.PrimitiveIndex);
+
+    glm::vec3 vertices[3], normals[3];
+    glm::vec2 uvs[3];
+    for (int i = 0; i < 3; i++)
+    {
+        vertices[i] = GetPosition(indices[i]);
+        uvs[i] = HasUVs() ? GetUV(indices[i]) : glm::vec2{ 0.0f };
+    }
+
+    if (HasNormals())
+    {
+        for (int i = 0; i < 3; i++)
+            normals[i] = GetNormal(indices[i]);
+    }
+    else
+    {
+        normals[0] = normals[1] = normals[2] = glm::normalize(glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+    }
+
+    ComputeTriangleInteraction(vertices, normals, uvs, ray, hit, intersect);
+}
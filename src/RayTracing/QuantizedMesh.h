@@ -0,0 +1,85 @@
+#pragma once
+
+#include "BVH.h"
+#include "Math.h"
+#include <string>
+#include <vector>
+
+// Compressed copy of a Mesh for very large assets, 14 bytes per vertex
+// instead of 32:
+//   positions  3 x 16 bits, relative to the mesh bounds
+//   normals    32-bit octahedral
+//   UVs        2 x 16 bits, relative to the UV bounds
+// Vertices decode the same way every time, so triangles sharing a vertex
+// still meet exactly and the watertight test keeps working.
+//
+// The mesh carries its own BVH. Triangles are reordered so every leaf is a
+// contiguous range of them, the nodes are all the tree adds and there is no
+// object per triangle.
+class QuantizedMesh
+{
+public:
+    // Reads the file one attribute at a time, only the attribute being
+    // compressed is ever held as floats
+    explicit QuantizedMesh(const std::string& plyFilePath);
+    explicit QuantizedMesh(const Mesh& mesh);
+
+    uint32_t GetTriangleCount() const           { return (uint32_t)(m_Indices.size() / 3); }
+    const uint32_t* GetTriangle(uint32_t i) const { return &m_Indices[3 * i]; }
+    bool HasNormals() const                     { return !m_Normals.empty(); }
+    bool HasUVs() const                         { return !m_UVs.empty(); }
+    const AABB& GetBounds() const               { return m_Bounds; }
+    size_t GetNodeCount() const                 { return m_Nodes.size(); }
+    size_t GetMemorySize() const;
+
+    glm::vec3 GetPosition(uint32_t vertex) const
+    {
+        const auto& q = m_Positions[vertex];
+        return m_PositionMin + glm::vec3{ q.X, q.Y, q.Z } * m_PositionScale;
+    }
+
+    glm::vec3 GetNormal(uint32_t vertex) const  { return DecodeOctahedral(m_Normals[vertex]); }
+
+    glm::vec2 GetUV(uint32_t vertex) const
+    {
+        const auto& q = m_UVs[vertex];
+        return m_UVMin + glm::vec2{ q.U, q.V } * m_UVScale;
+    }
+
+    // Closest hit in mesh space, hit->PrimitiveIndex is the triangle
+    bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const;
+    void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const;
+
+private:
+    struct QuantizedPosition
+    {
+        uint16_t X, Y, Z;
+    };
+
+    struct QuantizedUV
+    {
+        uint16_t U, V;
+    };
+
+    void QuantizePositions(const std::vector<glm::vec3>& vertices);
+    void QuantizeAttributes(const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& texCoords);
+
+    AABB GetTriangleBounds(uint32_t triangle) const;
+    void GetRangeBounds(uint32_t first, uint32_t count, AABB* bounds, AABB* centroidBounds) const;
+    void SwapTriangles(uint32_t a, uint32_t b);
+    void BuildBVH();
+    void BuildNode(uint32_t first, uint32_t count, const AABB& bounds, const AABB& centroidBounds, int depth);
+
+    AABB m_Bounds;
+    glm::vec3 m_PositionMin{ 0.0f };
+    glm::vec3 m_PositionScale{ 0.0f };
+    glm::vec2 m_UVMin{ 0.0f };
+    glm::vec2 m_UVScale{ 0.0f };
+
+    std::vector<QuantizedPosition> m_Positions;
+    std::vector<uint32_t> m_Normals;
+    std::vector<QuantizedUV> m_UVs;
+    std::vector<uint32_t> m_Indices;
+    // Depth-first, leaves index triangles rather than primitives
+    std::vector<LinearBVHNode, AlignedAllocator<LinearBVHNode, CacheLineSize>> m_Nodes;
+};
@@ -1,60 +1,95 @@
 #include "RayRenderer.h"
-#include <future>
+#include "RenderStats.h"
+#include "core/Trace.h"
+#include <atomic>
 
-void RayRenderer::Render(float* imageBuffer, std::shared_ptr<Scene> scene, std::shared_ptr<Camera> camera, int accumulateCount)
+// Offset of the traced pixel inside a stride x stride block for the given
+// pass, in Bayer order so consecutive passes land far apart
+static void GetBlockOffset(uint32_t pass, uint32_t stride, uint32_t& offsetX, uint32_t& offsetY)
+{
+    constexpr static uint32_t quadrantX[4] = { 0, 1, 1, 0 };
+    constexpr static uint32_t quadrantY[4] = { 0, 1, 0, 1 };
+
+    offsetX = 0;
+    offsetY = 0;
+    pass %= stride * stride;
+    for (uint32_t level = stride / 2; level > 0; level /= 2, pass /= 4)
+    {
+        offsetX += level * quadrantX[pass % 4];
+        offsetY += level * quadrantY[pass % 4];
+    }
+}
+
+float RayRenderer::Render(Film& film, std::shared_ptr<Scene> scene, std::shared_ptr<Camera> camera, int accumulateCount,
+    uint32_t pixelStride, const RenderBudget& budget)
 {
 
     m_Scene = scene;
     m_Camera = camera;
+    m_RayGenerator.Update(*camera);
 
-    std::vector<Tile> tiles;
+    if (!m_Workers)
+        m_Workers = std::make_unique<WorkerPool>("Render worker");
 
-    auto width = (uint32_t)camera->GetWidth();
-    auto height = (uint32_t)camera->GetHeight();
+    uint32_t offsetX, offsetY;
+    GetBlockOffset(accumulateCount - 1, pixelStride, offsetX, offsetY);
 
-    for (uint32_t i = 0; i < width; i += m_tileSize)
-    {
-        for (uint32_t j = 0; j < height; j += m_tileSize)
-        {
-            tiles.push_back(Tile{
-                i, j, std::min(i + m_tileSize, width), std::min(j + m_tileSize, height)
-            });
-        }
-    }
+    const uint32_t tileCount = film.GetTileCount();
+    if (m_TileCursor >= tileCount || pixelStride != 1)
+        m_ResumeRay = 0;
+    if (m_TileCursor >= tileCount)
+        m_TileCursor = 0;
 
-    std::vector<std::future<void>> futures;
-    
-    float count = (float)accumulateCount;
-    for (const auto& tile : tiles)
-    {
-        futures.push_back(std::async(std::launch::async, [&]() {
+    // Workers claim tiles in order starting at the cursor. The lowest order
+    // that was not finished is where the next pass starts, so interrupted
+    // passes do not starve the same tiles every time.
+    std::atomic<uint32_t> nextOrder{ 0 };
+    std::atomic<uint32_t> firstUnfinished{ tileCount };
+    std::atomic<uint32_t> tracedCount{ 0 };
+    std::vector<int> stoppedAt(tileCount, 0);
 
-            for (uint32_t i = tile.x0; i < tile.x1; i++)
+    // One task per pool thread, each claims tiles until none are left
+    m_Workers->ParallelFor(m_Workers->GetThreadCount(), [&](uint32_t, uint32_t) {
+        uint32_t traced = 0;
+        while (!budget.IsExhausted())
+        {
+            uint32_t order = nextOrder.fetch_add(1);
+            if (order >= tileCount)
+                break;
+
+            uint32_t tileIndex = (m_TileCursor + order) % tileCount;
+            int firstRay = order == 0 ? m_ResumeRay : 0;
+            int lastRay = RenderTile(film, tileIndex, pixelStride, offsetX, offsetY, firstRay, budget, traced);
+            if (budget.IsExhausted())
             {
-                for (uint32_t j = tile.y0; j < tile.y1; j++)
-                {
-                    auto ray = camera->GetCameraRay((float)i + 0.5f, (float)j + 0.5f);
-                    
-                    auto L = TraceRay(ray, m_Depth);
-                    // Format is 0xAABBGGRR
-                    glm::vec3 lastColor;
-                    auto pColor = &imageBuffer[(i + j * (uint32_t)camera->GetWidth()) * 3];
-                    lastColor.r = pColor[0];
-                    lastColor.g = pColor[1];
-                    lastColor.b = pColor[2];
-                
-                    auto color = (lastColor * (count - 1) / count) + (L / count);
-                
-                    pColor[0] = color.r;
-                    pColor[1] = color.g;
-                    pColor[2] = color.b;
-                }
+                stoppedAt[order] = lastRay;
+                uint32_t first = firstUnfinished.load();
+                while (order < first && !firstUnfinished.compare_exchange_weak(first, order))
+                    ;
             }
-        }));
+        }
+        tracedCount += traced;
+        RENDER_STATS_FLUSH();
+    });
+
+    uint32_t first = std::min(firstUnfinished.load(), std::min(nextOrder.load(), tileCount));
+    if (first < tileCount)
+    {
+        m_ResumeRay = pixelStride == 1 ? stoppedAt[first] : 0;
+        m_TileCursor = (m_TileCursor + first) % tileCount;
+    }
+    else
+    {
+        m_ResumeRay = 0;
     }
 
-    for (auto& fut : futures)
-        fut.get();
+    film.MergeTiles();
+
+    auto passPixels = [pixelStride](uint32_t extent, uint32_t offset) {
+        return extent > offset ? (extent - offset + pixelStride - 1) / pixelStride : 0;
+    };
+    uint32_t passPixelCount = passPixels(film.GetWidth(), offsetX) * passPixels(film.GetHeight(), offsetY);
+    return passPixelCount > 0 ? (float)tracedCount.load() / (float)passPixelCount : 1.0f;
     // for (uint32_t i = 0; i < camera->GetWidth(); i++) {
     //     for (uint32_t j = 0; j < camera->GetHeight(); j++) {
     //         auto ray = camera->GetCameraRay((float)i + 0.5f, (float)j + 0.5f);
@@ -76,30 +111,152 @@ void RayRenderer::Render(float* imageBuffer, std::shared_ptr<Scene> scene, std::
     // }
 }
 
-glm::vec3 RayRenderer::TraceRay(const Ray& ray, int depth)
+int RayRenderer::RenderTile(Film& film, uint32_t tileIndex, uint32_t pixelStride, uint32_t offsetX, uint32_t offsetY,
+    int firstRay, const RenderBudget& budget, uint32_t& tracedCount)
+{
+    TRACE_SCOPE("Tile");
+    auto& filmTile = film.BeginTile(tileIndex);
+    const auto& tile = filmTile.GetBounds();
+    auto sampler = m_Sampler->Clone();
+
+    // Tiles start on multiples of the stride, so stepping from the
+    // offset visits one pixel per block
+    uint32_t x0 = tile.x0 + offsetX;
+    uint32_t y0 = tile.y0 + offsetY;
+
+    // Pixels do not get a sample in every pass, and reprojected history is
+    // clamped below the number of samples it holds, so the film keeps the
+    // sequence index of every pixel
+    auto sampleIndex = [&](uint32_t i, uint32_t j) {
+        return film.GetSampleIndex(i, j);
+    };
+
+    // Camera dimensions of the whole tile first, then all primary
+    // rays in one batch
+    CameraRayBatch batch;
+    batch.Count = 0;
+    {
+        TRACE_SCOPE("Camera rays");
+        for (uint32_t i = x0; i < tile.x1; i += pixelStride)
+        {
+            for (uint32_t j = y0; j < tile.y1; j += pixelStride)
+            {
+                sampler->StartPixelSample(i, j, sampleIndex(i, j));
+                auto pixelSample = sampler->GetPixel2D();
+                batch.FilmX[batch.Count] = (float)i + pixelSample.x;
+                batch.FilmY[batch.Count] = (float)j + pixelSample.y;
+                batch.Time[batch.Count] = sampler->Get1D();
+                auto lensSample = sampler->Get2D();
+                batch.LensU[batch.Count] = lensSample.x;
+                batch.LensV[batch.Count] = lensSample.y;
+                batch.Count++;
+            }
+        }
+        m_RayGenerator.GenerateRays(batch);
+    }
+
+    // Traversal and shading alternate for every bounce, markers that fine
+    // would cost more than the work they time, the render statistics have
+    // the traversal share
+    TRACE_SCOPE("Trace paths");
+    int rayIndex = 0;
+    for (uint32_t i = x0; i < tile.x1; i += pixelStride)
+    {
+        for (uint32_t j = y0; j < tile.y1; j += pixelStride, rayIndex++)
+        {
+            if (rayIndex < firstRay)
+                continue;
+            if (budget.IsExhausted())
+                return rayIndex;
+
+            sampler->StartPixelSample(i, j, sampleIndex(i, j), cameraSampleDimensions);
+            auto ray = batch.GetRay(rayIndex);
+
+            FilmSample sample;
+            if (m_Integrator == Integrator::TraversalCost)
+                sample.L = TraceCost(ray, &sample);
+            else
+                sample.L = TraceRay(ray, m_Depth, *sampler, &sample);
+            filmTile.AddSample({ batch.FilmX[rayIndex], batch.FilmY[rayIndex] }, sample);
+            tracedCount++;
+        }
+    }
+    return rayIndex;
+}
+
+glm::vec3 RayRenderer::TraceCost(const Ray& ray, FilmSample* firstHit)
+{
+    RENDER_STAT_ADD(CameraRays, 1);
+
+    TraversalCost cost;
+    SurfaceInteraction intersect;
+    m_Scene->IntersectWithCost(ray, &intersect, cost);
+
+    // The AOVs keep reprojection working in this mode
+    if (intersect.HasIntersection)
+    {
+        RENDER_STAT_ADD(Hits, 1);
+        firstHit->Albedo = glm::vec3(1.0f);
+        firstHit->Normal = intersect.Normal;
+        firstHit->Depth = glm::length(intersect.Position - ray.Origin);
+        firstHit->Position = intersect.Position;
+    }
+
+    return glm::vec3((float)cost.NodesVisited, (float)cost.PrimitiveTests, 0.0f);
+}
+
+glm::vec3 RayRenderer::TraceRay(const Ray& ray, int depth, Sampler& sampler, FilmSample* firstHit)
 {
     if (depth <= 0)
     {
         return glm::vec3{ 0.0f };
     }
 
+    if (firstHit)
+        RENDER_STAT_ADD(CameraRays, 1);
+    else
+        RENDER_STAT_ADD(IndirectRays, 1);
+    RENDER_STAT_MAX(m_Depth - depth + 1);
+
+    // Every bounce draws the same dimensions whatever the material needs, so
+    // a dimension always feeds the same decision across samples
+    float uc = sampler.Get1D();
+    auto u = sampler.Get2D();
+    // Light sample, reserved until the renderer samples lights
+    sampler.Get2D();
+
     glm::vec3 L{ 0.0f };
     SurfaceInteraction intersect;
     m_Scene->Intersect(ray, &intersect);
 
     if (intersect.HasIntersection)
     {
+        RENDER_STAT_ADD(Hits, 1);
+
+        const auto& material = m_Scene->GetMaterials()[intersect.MaterialIndex];
+
         // Emitted Lighting
-        glm::vec3 emittedColor{ 0.0f };
-        intersect.Material->Emit(emittedColor);
+        glm::vec3 emittedColor = EmitMaterial(material);
         L += emittedColor;
-        glm::vec3 attenuation;
+        glm::vec3 attenuation{ 0.0f };
         
         // Scattered Lighting
         Ray scatteredRay;
-        if (intersect.Material->Scatter(ray, intersect, attenuation, scatteredRay))
+        bool scattered = ScatterMaterial(material, ray, intersect, uc, u, attenuation, scatteredRay);
+
+        if (firstHit)
+        {
+            // Lights have no albedo, their clamped emission keeps them visible in the AOV
+            firstHit->Albedo = glm::clamp(attenuation + emittedColor, 0.0f, 1.0f);
+            firstHit->Normal = intersect.Normal;
+            firstHit->Depth = glm::length(intersect.Position - ray.Origin);
+            firstHit->Position = intersect.Position;
+        }
+
+        if (scattered)
         {
             scatteredRay.Normalize();
+            scatteredRay.Time = ray.Time;
 
             // Direct Lighting
             // SurfaceInteraction visiblity;
@@ -108,13 +265,15 @@ glm::vec3 RayRenderer::TraceRay(const Ray& ray, int depth)
             //     L += attenuation * glm::vec3{ 0.1f } * glm::clamp(glm::dot(intersect.Normal, m_SkyLightDirection), 0.0f, 1.0f);
 
             // Indirect Lighting
-            L += attenuation * TraceRay(scatteredRay, depth-1);
+            L += attenuation * TraceRay(scatteredRay, depth-1, sampler);
 
         }
     }
     else
     {
         L += m_SkyLight;
+        if (firstHit)
+            firstHit->Albedo = m_SkyLight;
     }
     
     return L;
@@ -3,22 +3,57 @@
 #include "Scene.h"
 
 #include "Camera.h"
+#include "CameraRayGenerator.h"
+#include "Film.h"
+#include "RenderBudget.h"
+#include "Sampler.h"
+#include "WorkerPool.h"
+#include <memory>
 
-struct Tile
+enum class Integrator
 {
-    uint32_t x0, y0, x1, y1;
+    PathTracing,
+    // Primary rays only, the color holds the BVH nodes visited in R and the
+    // primitive tests in G
+    TraversalCost
 };
 
 class RayRenderer
 {
 public:
-    RayRenderer() {}
+    RayRenderer() : m_Sampler(CreateSampler(m_SamplerType)) {}
 
-    void Render(float* imageBuffer, std::shared_ptr<Scene> scene, std::shared_ptr<Camera> camera, int accumulateCount);
+    // Adds one sample per pixel to the film, accumulateCount is the 1-based
+    // pass index. With a pixelStride above 1 only one pixel of every
+    // pixelStride x pixelStride block is traced, the pass index picks which
+    // one so consecutive passes fill the blocks in. The pass stops early when
+    // the budget is exhausted and keeps what was traced, the returned value is
+    // the fraction of the pass that was rendered.
+    float Render(Film& film, std::shared_ptr<Scene> scene, std::shared_ptr<Camera> camera, int accumulateCount,
+        uint32_t pixelStride = 1, const RenderBudget& budget = {});
+
+    // Callers restart the accumulation after switching samplers
+    void SetSamplerType(SamplerType type)
+    {
+        m_SamplerType = type;
+        m_Sampler = CreateSampler(type);
+    }
+    SamplerType GetSamplerType() const { return m_SamplerType; }
+
+    // Callers restart the accumulation after switching integrators
+    void SetIntegrator(Integrator integrator) { m_Integrator = integrator; }
+    Integrator GetIntegrator() const { return m_Integrator; }
 
 private:
+    // Traces the pixels of the tile from firstRay on. Returns the index of
+    // the first pixel left out when the budget ran out, the pixel count of
+    // the tile otherwise.
+    int RenderTile(Film& film, uint32_t tileIndex, uint32_t pixelStride, uint32_t offsetX, uint32_t offsetY,
+        int firstRay, const RenderBudget& budget, uint32_t& tracedCount);
 
-    glm::vec3 TraceRay(const Ray& ray, int depth);
+    // firstHit receives the AOVs of the first intersection, only set for camera rays
+    glm::vec3 TraceRay(const Ray& ray, int depth, Sampler& sampler, FilmSample* firstHit = nullptr);
+    glm::vec3 TraceCost(const Ray& ray, FilmSample* firstHit);
 
     std::shared_ptr<Scene> m_Scene;
     std::shared_ptr<Camera> m_Camera;
@@ -27,6 +62,23 @@ private:
     // glm::vec3 m_SkyLight{ 0.0f };
     glm::vec3 m_SkyLightDirection = glm::normalize(glm::vec3{ 1.0f, 1.0f, 1.0f });
 
+    CameraRayGenerator m_RayGenerator;
+
+    Integrator m_Integrator = Integrator::PathTracing;
+    SamplerType m_SamplerType = SamplerType::Sobol;
+    // Prototype cloned by every tile
+    std::unique_ptr<Sampler> m_Sampler;
+    // Started on the first Render, the passes reuse the threads
+    std::unique_ptr<WorkerPool> m_Workers;
+    // First tile of the next pass, past the tiles an interrupted pass
+    // finished. A full resolution pass also resumes inside that tile, with a
+    // stride the next pass traces other pixels.
+    uint32_t m_TileCursor = 0;
+    int m_ResumeRay = 0;
+
+    // Pixel jitter, shutter time and lens position, the dimensions drawn
+    // before ray generation
+    constexpr static int cameraSampleDimensions = 5;
+
     const int m_Depth = 20;
-    const uint32_t m_tileSize = 16;
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+// Set from another thread to stop a running pass early
+class CancellationToken
+{
+public:
+    void Cancel() { m_Cancelled.store(true, std::memory_order_relaxed); }
+    void Reset() { m_Cancelled.store(false, std::memory_order_relaxed); }
+    bool IsCancelled() const { return m_Cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> m_Cancelled{ false };
+};
+
+// Limits of a render pass. Tiles check it between pixels and stop when it is
+// exhausted, the pixels traced until then are kept in the film. The default
+// budget is unlimited.
+struct RenderBudget
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point Deadline = Clock::time_point::max();
+    const CancellationToken* Token = nullptr;
+
+    // In milliseconds from now
+    static RenderBudget FromNow(float duration, const CancellationToken* token = nullptr)
+    {
+        RenderBudget budget;
+        budget.Deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(duration));
+        budget.Token = token;
+        return budget;
+    }
+
+    bool IsExhausted() const
+    {
+        if (Token && Token->IsCancelled())
+            return true;
+        return Deadline != Clock::time_point::max() && Clock::now() >= Deadline;
+    }
+};
@@ -0,0 +1,53 @@
+#include "RenderStats.h"
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+
+static std::mutex passTotalsMutex;
+static RenderCounters passTotals;
+
+void RenderCounters::Add(const RenderCounters& other)
+{
+    for (int i = 0; i < (int)RenderCounter::Count; i++)
+        Values[i] += other.Values[i];
+    MaxPathDepth = std::max(MaxPathDepth, other.MaxPathDepth);
+}
+
+void RenderStats::FlushThread()
+{
+    auto& counters = GetThreadCounters();
+    {
+        std::lock_guard<std::mutex> lock(passTotalsMutex);
+        passTotals.Add(counters);
+    }
+    counters = RenderCounters{};
+}
+
+RenderCounters RenderStats::TakePassTotals()
+{
+    std::lock_guard<std::mutex> lock(passTotalsMutex);
+    RenderCounters totals = passTotals;
+    passTotals = RenderCounters{};
+    return totals;
+}
+
+std::string RenderStats::ToJSON(const RenderCounters& counters, float renderTime)
+{
+    uint64_t rays = counters.GetRayCount();
+    auto perRay = [rays](uint64_t value) { return rays > 0 ? (double)value / (double)rays : 0.0; };
+
+    std::ostringstream json;
+    json << "{\"renderTimeMs\": " << renderTime
+         << ", \"mraysPerSecond\": " << (renderTime > 0.0f ? (double)rays / (renderTime * 1000.0) : 0.0)
+         << ", \"cameraRays\": " << counters[RenderCounter::CameraRays]
+         << ", \"indirectRays\": " << counters[RenderCounter::IndirectRays]
+         << ", \"nodesVisited\": " << counters[RenderCounter::NodesVisited]
+         << ", \"primitiveTests\": " << counters[RenderCounter::PrimitiveTests]
+         << ", \"hits\": " << counters[RenderCounter::Hits]
+         << ", \"maxPathDepth\": " << counters.MaxPathDepth
+         << ", \"nodesPerRay\": " << perRay(counters[RenderCounter::NodesVisited])
+         << ", \"primitiveTestsPerRay\": " << perRay(counters[RenderCounter::PrimitiveTests])
+         << ", \"hitRate\": " << perRay(counters[RenderCounter::Hits])
+         << "}";
+    return json.str();
+}
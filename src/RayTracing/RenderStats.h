@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Counting is compiled in with PBRMAN_RENDER_STATS, which src/CMakeLists.txt
+// only defines for Debug and RelWithDebInfo builds of the viewer. Without it
+// the macros below expand to nothing and the renderer pays nothing.
+
+enum class RenderCounter
+{
+    CameraRays,
+    IndirectRays,
+    NodesVisited,
+    PrimitiveTests,
+    Hits,
+    Count
+};
+
+struct RenderCounters
+{
+    uint64_t Values[(int)RenderCounter::Count] = {};
+    // Longest path in rays, camera ray included
+    uint64_t MaxPathDepth = 0;
+
+    uint64_t operator[](RenderCounter counter) const { return Values[(int)counter]; }
+    uint64_t GetRayCount() const { return (*this)[RenderCounter::CameraRays] + (*this)[RenderCounter::IndirectRays]; }
+
+    void Add(const RenderCounters& other);
+};
+
+// Every thread counts into its own counters without synchronization. Render
+// workers flush them into the pass totals once when they are done, so the
+// only shared write is a short lock per worker and pass.
+class RenderStats
+{
+public:
+#ifdef PBRMAN_RENDER_STATS
+    constexpr static bool enabled = true;
+#else
+    constexpr static bool enabled = false;
+#endif
+
+    static RenderCounters& GetThreadCounters()
+    {
+        thread_local RenderCounters counters;
+        return counters;
+    }
+
+    // Adds the counters of the calling thread to the pass totals and resets them
+    static void FlushThread();
+    // Returns the totals flushed since the last call
+    static RenderCounters TakePassTotals();
+
+    // One JSON object with the counters, Mrays/s and per-ray averages of a
+    // pass that took renderTime milliseconds
+    static std::string ToJSON(const RenderCounters& counters, float renderTime);
+};
+
+#ifdef PBRMAN_RENDER_STATS
+#define RENDER_STAT_ADD(counter, n) (RenderStats::GetThreadCounters().Values[(int)RenderCounter::counter] += (n))
+#define RENDER_STAT_MAX(value) \
+    do { auto& stats = RenderStats::GetThreadCounters(); if ((uint64_t)(value) > stats.MaxPathDepth) stats.MaxPathDepth = (value); } while (0)
+#define RENDER_STATS_FLUSH() RenderStats::FlushThread()
+#else
+// sizeof keeps locals that only feed the counters used without evaluating them
+#define RENDER_STAT_ADD(counter, n) ((void)sizeof(n))
+#define RENDER_STAT_MAX(value) ((void)sizeof(value))
+#define RENDER_STATS_FLUSH() ((void)0)
+#endif
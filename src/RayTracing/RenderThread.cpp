@@ -0,0 +1,235 @@
+#include "RenderThread.h"
+#include "core/Trace.h"
+#include <chrono>
+
+static glm::vec3 RRTAndODTFit(const glm::vec3& v)
+{
+    glm::vec3 a = v * (v + 0.0245786f) - 0.000090537f;
+    glm::vec3 b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
+    return a / b;
+}
+
+static glm::vec3 ToneMapACES(const glm::vec3& color)
+{
+    const float exposure = 1.0f;  // or compute per-scene
+    return RRTAndODTFit(color * exposure);
+}
+
+// Blue, cyan, green, yellow, red for t from 0 to 1, values past 1 stay red
+static glm::vec3 HeatmapColor(float t)
+{
+    constexpr static int stopCount = 5;
+    const glm::vec3 stops[stopCount] = {
+        { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }
+    };
+
+    float x = glm::clamp(t, 0.0f, 1.0f) * (stopCount - 1);
+    int i = std::min((int)x, stopCount - 2);
+    float f = x - (float)i;
+    return stops[i] * (1.0f - f) + stops[i + 1] * f;
+}
+
+RenderThread::RenderThread(std::shared_ptr<Scene> scene, const Camera& camera)
+    : m_Scene(scene), m_Camera(std::make_shared<Camera>(camera)),
+      m_Film((uint32_t)camera.GetWidth(), (uint32_t)camera.GetHeight())
+{
+}
+
+RenderThread::~RenderThread()
+{
+    Stop();
+}
+
+void RenderThread::Start()
+{
+    if (m_Running)
+        return;
+    m_Running = true;
+    m_Thread = std::thread([this]() { Run(); });
+}
+
+void RenderThread::Stop()
+{
+    if (!m_Running)
+        return;
+    m_Running = false;
+    m_Cancel.Cancel();
+    m_Thread.join();
+}
+
+void RenderThread::SetCamera(const Camera& camera)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        m_PendingCamera = std::make_shared<Camera>(camera);
+    }
+    m_Cancel.Cancel();
+}
+
+void RenderThread::SetSettings(const RenderSettings& settings)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        m_PendingSettings = settings;
+    }
+    m_Cancel.Cancel();
+}
+
+void RenderThread::ResetAccumulation()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        m_PendingReset = true;
+    }
+    m_Cancel.Cancel();
+}
+
+void RenderThread::Run()
+{
+    TRACE_THREAD_NAME("Render thread");
+    while (m_Running)
+    {
+        TRACE_SCOPE("Pass");
+        // Reset before taking the changes, a change made after this point
+        // cancels the coming pass and is picked up by the next one
+        m_Cancel.Reset();
+        if (!m_Running)
+            break;
+        bool cameraMoved = ApplyPendingChanges();
+
+        m_PassIndex++;
+        uint32_t pixelStride = m_DynamicResolution.GetPixelStride();
+        RenderBudget budget;
+        if (m_Settings.FrameBudget)
+            budget = RenderBudget::FromNow(m_Settings.TargetFrameTime);
+        budget.Token = &m_Cancel;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        float passFraction;
+        {
+            TRACE_SCOPE("Render");
+            passFraction = m_Renderer.Render(m_Film, m_Scene, m_Camera, m_PassIndex, pixelStride, budget);
+        }
+        auto renderTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        m_DynamicResolution.Update(renderTime, passFraction, cameraMoved);
+
+        auto& frame = m_Frames.GetWriteBuffer();
+        Resolve(frame);
+        frame.PassIndex = m_PassIndex;
+        frame.PixelStride = pixelStride;
+        frame.RenderTime = renderTime;
+        frame.Stats = RenderStats::TakePassTotals();
+        m_Frames.Publish();
+    }
+}
+
+bool RenderThread::ApplyPendingChanges()
+{
+    TRACE_SCOPE("Apply changes");
+    std::shared_ptr<Camera> camera;
+    RenderSettings settings;
+    bool reset;
+    {
+        std::lock_guard<std::mutex> lock(m_PendingMutex);
+        camera = std::move(m_PendingCamera);
+        settings = m_PendingSettings;
+        reset = m_PendingReset;
+        m_PendingReset = false;
+    }
+
+    if (settings.IntegratorType != m_Settings.IntegratorType)
+    {
+        m_Renderer.SetIntegrator(settings.IntegratorType);
+        reset = true;
+    }
+    if (settings.Sampler != m_Settings.Sampler)
+    {
+        m_Renderer.SetSamplerType(settings.Sampler);
+        reset = true;
+    }
+    if (settings.Filter != m_Settings.Filter)
+    {
+        m_Film.SetFilter(settings.Filter);
+        reset = true;
+    }
+    m_DynamicResolution.SetEnabled(settings.DynamicResolution);
+    m_DynamicResolution.SetTargetFrameTime(settings.TargetFrameTime);
+    m_Settings = settings;
+
+    if (camera)
+        m_Camera = camera;
+
+    if (reset || (camera && !m_Settings.TemporalReprojection))
+    {
+        m_Film.Clear();
+        m_PassIndex = 0;
+    }
+    else if (camera)
+    {
+        // The pass index keeps counting so the new samples continue the
+        // sequence of the carried ones
+        m_Film.Reproject(*m_Camera, (float)m_Settings.MaxHistorySamples);
+    }
+
+    return camera != nullptr;
+}
+
+void RenderThread::Resolve(ResolvedFrame& frame)
+{
+    TRACE_SCOPE("Resolve");
+    uint32_t width = m_Film.GetWidth();
+    uint32_t height = m_Film.GetHeight();
+    frame.Pixels.resize((size_t)width * height);
+
+    // Strided and interrupted passes leave pixels without samples, the
+    // denoiser waits until every pixel has one
+    bool showHeatmap = m_Settings.IntegratorType == Integrator::TraversalCost && m_Settings.DisplayOutput == 0;
+    bool showDenoised = m_Settings.Denoise && m_Settings.DisplayOutput == 0 && !showHeatmap && m_Film.IsCovered();
+    if (showDenoised)
+        m_Denoiser.Denoise(m_Film);
+    // Blocks cut by the image border may miss their traced pixel, the next
+    // larger block has one
+    constexpr uint32_t upscaleBlockSize = 2 * DynamicResolution::maxStride;
+
+    for (uint32_t j = 0; j < height; j++)
+    {
+        for (uint32_t i = 0; i < width; i++)
+        {
+            glm::vec3 rgb;
+            if (showHeatmap)
+            {
+                // The film holds the average cost of the pixel's primary rays
+                auto cost = m_Film.GetUpscaledPixelColor(i, j, upscaleBlockSize);
+                float value = m_Settings.Metric == HeatmapMetric::NodesVisited ? cost.x : cost.y;
+                rgb = HeatmapColor(value / m_Settings.HeatmapScale);
+            }
+            else if (m_Settings.DisplayOutput == 0)
+            {
+                rgb = showDenoised ? m_Denoiser.GetPixelColor(i, j) : m_Film.GetUpscaledPixelColor(i, j, upscaleBlockSize);
+                rgb = ToneMapACES(rgb);
+                // Gamma Correction
+                rgb = glm::pow(rgb, glm::vec3{ 1.0f / 2.2f });
+            }
+            else
+            {
+                auto aov = (FilmAOV)(m_Settings.DisplayOutput - 1);
+                rgb = m_Film.GetAOV(aov, i, j);
+                if (aov == FilmAOV::Normal)
+                    rgb = rgb * 0.5f + 0.5f;
+                else if (aov == FilmAOV::Depth)
+                    rgb = glm::vec3(rgb.x / (1.0f + rgb.x));
+                else if (aov == FilmAOV::Position)
+                    rgb = glm::fract(rgb);
+                else if (aov == FilmAOV::SampleCount)
+                    rgb = glm::vec3(rgb.x / (float)std::max(m_PassIndex, 1));
+            }
+
+            rgb = glm::clamp(rgb, 0.0f, 1.0f);
+            frame.Pixels[(size_t)j * width + i] =
+                static_cast<uint32_t>(rgb.r * 255.0f) << 0 |
+                static_cast<uint32_t>(rgb.g * 255.0f) << 8 |
+                static_cast<uint32_t>(rgb.b * 255.0f) << 16 |
+                0xFF000000;
+        }
+    }
+}
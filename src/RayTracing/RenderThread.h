@@ -0,0 +1,104 @@
+#pragma once
+
+#include "RayRenderer.h"
+#include "Denoiser.h"
+#include "DynamicResolution.h"
+#include "RenderStats.h"
+#include "core/TripleBuffer.h"
+#include <mutex>
+#include <thread>
+
+enum class HeatmapMetric
+{
+    NodesVisited,
+    PrimitiveTests
+};
+
+struct RenderSettings
+{
+    Integrator IntegratorType = Integrator::PathTracing;
+    // Traversal cost display, the metric value that maps to the top of the
+    // color ramp
+    HeatmapMetric Metric = HeatmapMetric::NodesVisited;
+    float HeatmapScale = 100.0f;
+    SamplerType Sampler = SamplerType::Sobol;
+    FilterType Filter = FilterType::Box;
+    // 0 shows the color, otherwise FilmAOV + 1
+    int DisplayOutput = 0;
+    bool Denoise = true;
+    // Camera motion reprojects the film instead of clearing it
+    bool TemporalReprojection = true;
+    int MaxHistorySamples = 32;
+    bool DynamicResolution = true;
+    // In milliseconds
+    float TargetFrameTime = 33.0f;
+    // Cuts passes at the target frame time so camera changes show up quickly
+    bool FrameBudget = true;
+};
+
+// Tonemapped result of a pass, ready for upload
+struct ResolvedFrame
+{
+    // 0xAABBGGRR
+    std::vector<uint32_t> Pixels;
+    int PassIndex = 0;
+    uint32_t PixelStride = 1;
+    // In milliseconds, of the pass alone
+    float RenderTime = 0.0f;
+    // Empty unless PBRMAN_RENDER_STATS is defined
+    RenderCounters Stats;
+};
+
+// Runs render passes back to back on its own thread, independent of the
+// presentation frame rate. Camera and settings changes from the
+// presentation thread are picked up between passes and cancel the running
+// one. Every pass is resolved into a frame that is handed over through a
+// triple buffer, the render thread never waits for a present.
+class RenderThread
+{
+public:
+    RenderThread(std::shared_ptr<Scene> scene, const Camera& camera);
+    ~RenderThread();
+
+    void Start();
+    void Stop();
+
+    // Presentation thread side
+    void SetCamera(const Camera& camera);
+    void SetSettings(const RenderSettings& settings);
+    void ResetAccumulation();
+
+    // True when a frame was published since the last call, GetFrame returns
+    // it until the next successful call
+    bool AcquireFrame() { return m_Frames.Acquire(); }
+    const ResolvedFrame& GetFrame() const { return m_Frames.GetReadBuffer(); }
+
+private:
+    void Run();
+    // Returns true when the camera changed
+    bool ApplyPendingChanges();
+    void Resolve(ResolvedFrame& frame);
+
+    std::shared_ptr<Scene> m_Scene;
+
+    // Only touched by the render thread
+    std::shared_ptr<Camera> m_Camera;
+    Film m_Film;
+    RayRenderer m_Renderer;
+    Denoiser m_Denoiser;
+    DynamicResolution m_DynamicResolution;
+    RenderSettings m_Settings;
+    int m_PassIndex = 0;
+
+    // Handed over from the presentation thread
+    std::mutex m_PendingMutex;
+    std::shared_ptr<Camera> m_PendingCamera;
+    RenderSettings m_PendingSettings;
+    bool m_PendingReset = false;
+    CancellationToken m_Cancel;
+
+    TripleBuffer<ResolvedFrame> m_Frames;
+
+    std::atomic<bool> m_Running{ false };
+    std::thread m_Thread;
+};
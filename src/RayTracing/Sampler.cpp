@@ -0,0 +1,322 @@
+#include "Sampler.h"
+
+static float ToUnitFloat(uint32_t v)
+{
+    return std::min(OneMinusEpsilon, v * 2.3283064365386963e-10f);
+}
+
+// Element i of a random permutation of [0, l) selected by p (Kensler 2013)
+static uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+static uint32_t ReverseBits(uint32_t v)
+{
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+// Nested uniform (Owen) scrambling through a hash that only propagates bits
+// upwards, applied to the reversed bits so higher bits depend on lower ones
+static uint32_t NestedUniformScramble(uint32_t v, uint32_t seed)
+{
+    v = ReverseBits(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return ReverseBits(v);
+}
+
+// Second Sobol dimension, its generator matrix is Pascal's triangle mod 2.
+// The first dimension is the bit reversal of the index.
+static uint32_t SobolSecondDimension(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+static glm::vec2 ScrambledSobol2D(uint32_t sampleIndex, uint64_t hash)
+{
+    uint32_t index = NestedUniformScramble(sampleIndex, (uint32_t)hash);
+    uint32_t x = NestedUniformScramble(ReverseBits(index), (uint32_t)(hash >> 32));
+    uint32_t y = NestedUniformScramble(SobolSecondDimension(index), (uint32_t)MixBits(hash));
+    return { ToUnitFloat(x), ToUnitFloat(y) };
+}
+
+static float ScrambledSobol1D(uint32_t sampleIndex, uint64_t hash)
+{
+    uint32_t index = NestedUniformScramble(sampleIndex, (uint32_t)hash);
+    return ToUnitFloat(NestedUniformScramble(ReverseBits(index), (uint32_t)(hash >> 32)));
+}
+
+void IndependentSampler::StartPixelSample(int px, int py, uint32_t sampleIndex, int dimension)
+{
+    Sampler::StartPixelSample(px, py, sampleIndex, dimension);
+    m_Rng.SetSequence(Hash(px, py, m_Seed));
+    m_Rng.Advance(sampleIndex * 65536ull + dimension);
+}
+
+float IndependentSampler::Get1D()
+{
+    return m_Rng.UniformFloat();
+}
+
+glm::vec2 IndependentSampler::Get2D()
+{
+    float x = m_Rng.UniformFloat();
+    float y = m_Rng.UniformFloat();
+    return { x, y };
+}
+
+void StratifiedSampler::StartPixelSample(int px, int py, uint32_t sampleIndex, int dimension)
+{
+    Sampler::StartPixelSample(px, py, sampleIndex, dimension);
+    m_Rng.SetSequence(Hash(px, py, m_Seed));
+    m_Rng.Advance(sampleIndex * 65536ull + dimension);
+}
+
+int StratifiedSampler::GetStratum()
+{
+    uint32_t samplesPerPixel = m_XPixelSamples * m_YPixelSamples;
+    uint32_t pass = m_SampleIndex / samplesPerPixel;
+    uint64_t hash = Hash(((uint64_t)m_PixelX << 32) | (uint32_t)m_PixelY, m_Dimension, m_Seed, pass);
+    return PermutationElement(m_SampleIndex % samplesPerPixel, samplesPerPixel, (uint32_t)hash);
+}
+
+float StratifiedSampler::Get1D()
+{
+    int stratum = GetStratum();
+    m_Dimension++;
+    return (stratum + m_Rng.UniformFloat()) / (m_XPixelSamples * m_YPixelSamples);
+}
+
+glm::vec2 StratifiedSampler::Get2D()
+{
+    int stratum = GetStratum();
+    m_Dimension += 2;
+    int x = stratum % m_XPixelSamples;
+    int y = stratum / m_XPixelSamples;
+    float dx = m_Rng.UniformFloat();
+    float dy = m_Rng.UniformFloat();
+    return { (x + dx) / m_XPixelSamples, (y + dy) / m_YPixelSamples };
+}
+
+float SobolSampler::Get1D()
+{
+    uint64_t hash = Hash(((uint64_t)m_PixelX << 32) | (uint32_t)m_PixelY, m_Dimension, m_Seed);
+    m_Dimension++;
+    return ScrambledSobol1D(m_SampleIndex, hash);
+}
+
+glm::vec2 SobolSampler::Get2D()
+{
+    uint64_t hash = Hash(((uint64_t)m_PixelX << 32) | (uint32_t)m_PixelY, m_Dimension, m_Seed);
+    m_Dimension += 2;
+    return ScrambledSobol2D(m_SampleIndex, hash);
+}
+
+BlueNoiseSampler::BlueNoiseSampler(uint32_t seed)
+    : Sampler(seed), m_Mask(&GetBlueNoiseMask())
+{
+}
+
+float BlueNoiseSampler::GetMaskValue(int dimension, int component) const
+{
+    // Every dimension reads the mask at its own toroidal offset
+    uint64_t offset = Hash(dimension, component, m_Seed);
+    int x = (m_PixelX + (int)(offset & (blueNoiseMaskSize - 1))) & (blueNoiseMaskSize - 1);
+    int y = (m_PixelY + (int)((offset >> 16) & (blueNoiseMaskSize - 1))) & (blueNoiseMaskSize - 1);
+    return (*m_Mask)[y * blueNoiseMaskSize + x];
+}
+
+float BlueNoiseSampler::Get1D()
+{
+    // The sequence is the same for every pixel, only the rotation differs
+    float u = ScrambledSobol1D(m_SampleIndex, Hash(m_Dimension, m_Seed));
+    u += GetMaskValue(m_Dimension, 0);
+    m_Dimension++;
+    return std::min(OneMinusEpsilon, u >= 1.0f ? u - 1.0f : u);
+}
+
+glm::vec2 BlueNoiseSampler::Get2D()
+{
+    auto u = ScrambledSobol2D(m_SampleIndex, Hash(m_Dimension, m_Seed));
+    u.x += GetMaskValue(m_Dimension, 0);
+    u.y += GetMaskValue(m_Dimension, 1);
+    m_Dimension += 2;
+    return {
+        std::min(OneMinusEpsilon, u.x >= 1.0f ? u.x - 1.0f : u.x),
+        std::min(OneMinusEpsilon, u.y >= 1.0f ? u.y - 1.0f : u.y)
+    };
+}
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, uint32_t seed)
+{
+    switch (type)
+    {
+    case SamplerType::Independent:
+        return std::make_unique<IndependentSampler>(seed);
+    case SamplerType::Stratified:
+        return std::make_unique<StratifiedSampler>(4, 4, seed);
+    case SamplerType::Sobol:
+        return std::make_unique<SobolSampler>(seed);
+    case SamplerType::BlueNoise:
+        return std::make_unique<BlueNoiseSampler>(seed);
+    }
+    return std::make_unique<IndependentSampler>(seed);
+}
+
+// Void-and-cluster (Ulichney 1993) on a torus. The energy of a cell is the
+// Gaussian-weighted count of set cells around it, clusters are the set cells
+// with the highest energy and voids the empty cells with the lowest.
+static std::vector<float> GenerateBlueNoiseMask()
+{
+    constexpr int size = blueNoiseMaskSize;
+    constexpr int count = size * size;
+    constexpr float sigma = 1.5f;
+
+    std::vector<float> kernel(count);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            int dx = std::min(x, size - x);
+            int dy = std::min(y, size - y);
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+
+    auto toggle = [&](int cell, bool set) {
+        pattern[cell] = set ? 1 : 0;
+        float sign = set ? 1.0f : -1.0f;
+        int cx = cell % size;
+        int cy = cell / size;
+        for (int y = 0; y < size; y++)
+        {
+            const float* kernelRow = &kernel[((y - cy) & (size - 1)) * size];
+            float* energyRow = &energy[y * size];
+            for (int x = 0; x < size; x++)
+                energyRow[x] += sign * kernelRow[(x - cx) & (size - 1)];
+        }
+    };
+
+    auto tightestCluster = [&]() {
+        int best = -1;
+        for (int i = 0; i < count; i++)
+        {
+            if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+                best = i;
+        }
+        return best;
+    };
+
+    auto largestVoid = [&]() {
+        int best = -1;
+        for (int i = 0; i < count; i++)
+        {
+            if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                best = i;
+        }
+        return best;
+    };
+
+    // Random initial points, then move clusters into voids until stable
+    PCG32 rng;
+    int initialCount = count / 10;
+    for (int placed = 0; placed < initialCount;)
+    {
+        int cell = rng.Uniform32() % count;
+        if (!pattern[cell])
+        {
+            toggle(cell, true);
+            placed++;
+        }
+    }
+
+    for (int iteration = 0; iteration < count; iteration++)
+    {
+        int cluster = tightestCluster();
+        toggle(cluster, false);
+        int emptiest = largestVoid();
+        toggle(emptiest, true);
+        if (emptiest == cluster)
+            break;
+    }
+
+    std::vector<int> rank(count);
+    auto initialPattern = pattern;
+    auto initialEnergy = energy;
+
+    // Ranks below the initial pattern: remove the tightest clusters
+    for (int r = initialCount - 1; r >= 0; r--)
+    {
+        int cluster = tightestCluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+
+    // Ranks above: fill the largest voids. Past half the cells this is the
+    // same as removing the tightest clusters of empty cells, because both
+    // energies sum to the constant kernel total.
+    pattern = initialPattern;
+    energy = initialEnergy;
+    for (int r = initialCount; r < count; r++)
+    {
+        int emptiest = largestVoid();
+        toggle(emptiest, true);
+        rank[emptiest] = r;
+    }
+
+    std::vector<float> mask(count);
+    for (int i = 0; i < count; i++)
+        mask[i] = (rank[i] + 0.5f) / count;
+    return mask;
+}
+
+const std::vector<float>& GetBlueNoiseMask()
+{
+    static const std::vector<float> mask = GenerateBlueNoiseMask();
+    return mask;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "core/Core.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Largest float below 1, keeps [0, 1) samples from rounding up to 1
+constexpr static float OneMinusEpsilon = 0.99999994f;
+
+inline uint64_t MixBits(uint64_t v)
+{
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ull;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= (v >> 33);
+    return v;
+}
+
+inline uint64_t Hash(uint64_t a, uint64_t b, uint64_t c = 0, uint64_t d = 0)
+{
+    uint64_t h = MixBits(a + 0x9e3779b97f4a7c15ull);
+    h = MixBits(h ^ (b + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    h = MixBits(h ^ (c + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    h = MixBits(h ^ (d + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    return h;
+}
+
+// PCG32 generator (O'Neill), supports jumping to an arbitrary point of a stream
+class PCG32
+{
+public:
+    PCG32() { SetSequence(1); }
+
+    void SetSequence(uint64_t sequenceIndex, uint64_t seed = 0x853c49e6748fea9bull)
+    {
+        m_State = 0u;
+        m_Inc = (sequenceIndex << 1u) | 1u;
+        Uniform32();
+        m_State += seed;
+        Uniform32();
+    }
+
+    uint32_t Uniform32()
+    {
+        uint64_t oldState = m_State;
+        m_State = oldState * multiplier + m_Inc;
+        auto xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+        auto rot = (uint32_t)(oldState >> 59u);
+        return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+    }
+
+    float UniformFloat()
+    {
+        return std::min(OneMinusEpsilon, Uniform32() * 2.3283064365386963e-10f);
+    }
+
+    void Advance(uint64_t delta)
+    {
+        uint64_t curMult = multiplier, curPlus = m_Inc, accMult = 1u, accPlus = 0u;
+        while (delta > 0)
+        {
+            if (delta & 1)
+            {
+                accMult *= curMult;
+                accPlus = accPlus * curMult + curPlus;
+            }
+            curPlus = (curMult + 1) * curPlus;
+            curMult *= curMult;
+            delta /= 2;
+        }
+        m_State = accMult * m_State + accPlus;
+    }
+
+private:
+    constexpr static uint64_t multiplier = 0x5851f42d4c957f2dull;
+
+    uint64_t m_State;
+    uint64_t m_Inc;
+};
+
+enum class SamplerType
+{
+    Independent,    // uniform random numbers
+    Stratified,     // jittered strata, shuffled per dimension
+    Sobol,          // Owen-scrambled Sobol, dimensions padded in pairs
+    BlueNoise       // Sobol sequence shared by all pixels, rotated by a blue-noise mask
+};
+
+// Supplies the sample dimensions for one pixel sample. The renderer calls
+// StartPixelSample for every pixel and then consumes the dimensions in a
+// fixed order: pixel jitter, shutter time, lens position, then per bounce
+// the BSDF component, the BSDF direction and the light sample.
+class Sampler
+{
+public:
+    Sampler(uint32_t seed) : m_Seed(seed) {}
+    virtual ~Sampler() = default;
+
+    virtual void StartPixelSample(int px, int py, uint32_t sampleIndex, int dimension = 0)
+    {
+        m_PixelX = px;
+        m_PixelY = py;
+        m_SampleIndex = sampleIndex;
+        m_Dimension = dimension;
+    }
+
+    virtual float Get1D() = 0;
+    virtual glm::vec2 Get2D() = 0;
+    glm::vec2 GetPixel2D() { return Get2D(); }
+
+    // Samplers keep per-pixel state, so every render task works on its own clone
+    virtual std::unique_ptr<Sampler> Clone() const = 0;
+
+protected:
+    uint32_t m_Seed;
+    int m_PixelX = 0;
+    int m_PixelY = 0;
+    uint32_t m_SampleIndex = 0;
+    int m_Dimension = 0;
+};
+
+class IndependentSampler : public Sampler
+{
+public:
+    IndependentSampler(uint32_t seed = 0) : Sampler(seed) {}
+
+    virtual void StartPixelSample(int px, int py, uint32_t sampleIndex, int dimension = 0) override;
+    virtual float Get1D() override;
+    virtual glm::vec2 Get2D() override;
+    virtual std::unique_ptr<Sampler> Clone() const override { return std::make_unique<IndependentSampler>(*this); }
+
+private:
+    PCG32 m_Rng;
+};
+
+// The renderer accumulates an unbounded number of samples, so the strata are
+// reshuffled for every group of SamplesPerPixel samples
+class StratifiedSampler : public Sampler
+{
+public:
+    StratifiedSampler(int xPixelSamples = 4, int yPixelSamples = 4, uint32_t seed = 0)
+        : Sampler(seed), m_XPixelSamples(xPixelSamples), m_YPixelSamples(yPixelSamples) {}
+
+    virtual void StartPixelSample(int px, int py, uint32_t sampleIndex, int dimension = 0) override;
+    virtual float Get1D() override;
+    virtual glm::vec2 Get2D() override;
+    virtual std::unique_ptr<Sampler> Clone() const override { return std::make_unique<StratifiedSampler>(*this); }
+
+private:
+    int GetStratum();
+
+    int m_XPixelSamples;
+    int m_YPixelSamples;
+    PCG32 m_Rng;
+};
+
+// Two-dimensional Sobol points with hash-based Owen scrambling (Burley 2020).
+// Every dimension pair shuffles the sample index independently, so any number
+// of dimensions can be drawn and each 2D projection keeps its stratification.
+class SobolSampler : public Sampler
+{
+public:
+    SobolSampler(uint32_t seed = 0) : Sampler(seed) {}
+
+    virtual float Get1D() override;
+    virtual glm::vec2 Get2D() override;
+    virtual std::unique_ptr<Sampler> Clone() const override { return std::make_unique<SobolSampler>(*this); }
+};
+
+// Blue-noise dithered sampling (Georgiev and Fajardo 2016): all pixels share
+// one scrambled Sobol sequence and a per-pixel value from a void-and-cluster
+// mask rotates it, which pushes the remaining error to high frequencies
+class BlueNoiseSampler : public Sampler
+{
+public:
+    BlueNoiseSampler(uint32_t seed = 0);
+
+    virtual float Get1D() override;
+    virtual glm::vec2 Get2D() override;
+    virtual std::unique_ptr<Sampler> Clone() const override { return std::make_unique<BlueNoiseSampler>(*this); }
+
+private:
+    float GetMaskValue(int dimension, int component) const;
+
+    const std::vector<float>* m_Mask;
+};
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, uint32_t seed = 0);
+
+// Ranks of a toroidal void-and-cluster pattern, mapped to (0, 1)
+constexpr static int blueNoiseMaskSize = 64;
+const std::vector<float>& GetBlueNoiseMask();
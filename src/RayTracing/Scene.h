@@ -1,9 +1,11 @@
 #pragma once
 
 #include "Primitive.h"
+#include <unordered_map>
 #include <vector>
 #include "Core/Mesh.h"
 #include "BVH.h"
+#include "MeshRegistry.h"
 
 class Scene
 {
@@ -56,6 +58,9 @@ public:
             glm::vec3{ 0.0f },
             glm::vec3{ 4.0f, 1.0f, 0.0f }
         );
+        // Motion blur
+        // circle2->AddMotionKeyframe(0.0f, glm::vec3{ 1.0f }, glm::vec3{ 0.0f }, glm::vec3{ 4.0f, 1.0f, 0.0f });
+        // circle2->AddMotionKeyframe(1.0f, glm::vec3{ 1.0f }, glm::vec3{ 0.0f }, glm::vec3{ 4.0f, 2.0f, 0.0f });
         auto circle3 = std::make_shared<SimplePrimitive>(
             std::make_shared<Circle>(1.0f),
             std::make_unique<LambertianMaterial>(glm::vec3{ 1.0f, 0.2f, 0.2f })
@@ -102,15 +107,16 @@ public:
         simplePrimitives.push_back(lightQuad);
         simplePrimitives.push_back(lightQuad2);
         
-        auto bunny = std::make_shared<Mesh>(
-            // "../../assets/icosahedron.ply"
-            // "../../assets/cube_uv.ply"
-            "../../assets/bunny.ply"
-            // "../../assets/feline.ply"
-        );
-
+        // Placed once each, so their triangles go into the scene BVH directly.
+        // Repeated placements should use m_Meshes.CreateInstance, which shares
+        // the triangles and their BVH between placements.
         auto bunnyMesh = std::make_shared<TriangleList>(
-            *bunny,
+            m_Meshes.GetMesh(
+                // "../../assets/icosahedron.ply"
+                // "../../assets/cube_uv.ply"
+                "../../assets/bunny.ply"
+                // "../../assets/feline.ply"
+            ),
             // std::make_unique<DielectricMaterial>(0.9f)
             // std::make_unique<EmissiveMaterial>(glm::vec3{ 5.0f, 5.0f, 4.0f })
             std::make_shared<MetalMaterial>(glm::vec3{ 1.0f, 1.0f, 1.0f }, 0.5f)
@@ -122,9 +128,8 @@ public:
             glm::vec3{ 1.0f, 1.5f, 0.0f }
         );
         
-        auto feline = std::make_shared<Mesh>("../../assets/dragon.ply");
         auto felineMesh = std::make_shared<TriangleList>(
-            *feline,
+            m_Meshes.GetMesh("../../assets/dragon.ply"),
             std::make_shared<LambertianMaterial>(glm::vec3{ 1.0f, 1.0f, 1.0f})
         );
         felineMesh->SetTransform(
@@ -136,7 +141,11 @@ public:
         auto felineTriangles = felineMesh->GetPrimitives();
         simplePrimitives.insert(simplePrimitives.begin(), bunnyTriangles.begin(), bunnyTriangles.end());
         simplePrimitives.insert(simplePrimitives.begin(), felineTriangles.begin(), felineTriangles.end());
-        m_BVH = std::make_shared<BVH>(simplePrimitives);
+        BVHBuildOptions bvhOptions;
+        RegisterMaterials(simplePrimitives);
+        bvhOptions.SplitMethod = BVHSplitMethod::SAH;
+        // bvhOptions.SplitMethod = BVHSplitMethod::SBVH;
+        m_BVH = std::make_shared<BVH>(simplePrimitives, bvhOptions);
     }
 
     void Intersect(const Ray& ray, SurfaceInteraction* intersect)
@@ -145,6 +154,22 @@ public:
         m_BVH->Intersect(ray, intersect);
     }
 
+    void IntersectWithCost(const Ray& ray, SurfaceInteraction* intersect, TraversalCost& cost)
+    {
+        m_BVH->IntersectWithCost(ray, intersect, cost);
+    }
+
+    // Call after moving primitives, rebuilds the BVH if the refit tree has degraded too much
+    bool RefitBVH()
+    {
+        return m_BVH->Refit();
+    }
+
+    const MaterialTable& GetMaterials() const
+    {
+        return m_Materials;
+    }
+
     // FOr debug purposes
     BVH& GetBVH() 
     {
@@ -152,6 +177,24 @@ public:
     }
 
 private:
+    // Primitives sharing a material object share its table entry, a mesh
+    // takes one entry for all of its triangles
+    void RegisterMaterials(const std::vector<std::shared_ptr<SimplePrimitive>>& primitives)
+    {
+        std::unordered_map<const Material*, MaterialID> materialIDs;
+        for (const auto& primitive : primitives)
+        {
+            const Material* material = &primitive->GetMaterial();
+            auto it = materialIDs.find(material);
+            if (it == materialIDs.end())
+                it = materialIDs.emplace(material, m_Materials.Add(material->GetData())).first;
+            primitive->SetMaterialID(it->second);
+        }
+    }
+
     PrimitiveList m_Primitives;
+    // Declared before anything holding its meshes
+    MeshRegistry m_Meshes;
+    MaterialTable m_Materials;
     std::shared_ptr<BVH> m_BVH;
 };
\ No newline at end of file
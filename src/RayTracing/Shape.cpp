@@ -1,54 +1,120 @@
 #include "Shape.h"
+#include "RenderStats.h"
 
-constexpr static float tMin = 0.001f;
+// Sutherland-Hodgman clip of a convex polygon against the six box planes,
+// a convex polygon gains at most one vertex per plane
+constexpr static int maxClipVertices = 16;
 
-void Circle::Intersect(const Ray &ray, SurfaceInteraction* intersect) const
+static AABB ClipPolygonBounds(const glm::vec3* vertices, int count, const AABB& clip)
 {
+    glm::vec3 polygon[maxClipVertices];
+    glm::vec3 clipped[maxClipVertices];
+    for (int i = 0; i < count; i++)
+        polygon[i] = vertices[i];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            float plane = side == 0 ? clip.Min[axis] : clip.Max[axis];
+            auto inside = [&](const glm::vec3& v) { 
+                return side == 0 ? v[axis] >= plane : v[axis] <= plane; 
+            };
+
+            int clippedCount = 0;
+            for (int i = 0; i < count; i++)
+            {
+                const auto& a = polygon[i];
+                const auto& b = polygon[(i + 1) % count];
+                bool aInside = inside(a);
+                bool bInside = inside(b);
+                if (aInside)
+                    clipped[clippedCount++] = a;
+                if (aInside != bInside)
+                {
+                    float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    auto v = a + (b - a) * t;
+                    v[axis] = plane;
+                    clipped[clippedCount++] = v;
+                }
+            }
+
+            count = clippedCount;
+            if (count == 0)
+                return AABB{};
+            for (int i = 0; i < count; i++)
+                polygon[i] = clipped[i];
+        }
+    }
+
+    AABB bounds;
+    for (int i = 0; i < count; i++)
+        bounds = AABB::Union(bounds, polygon[i]);
+    // Guard against round-off pushing the result outside the clip box
+    return AABB::Intersect(bounds, clip);
+}
+
+AABB Shape::GetClippedAABB(Transform* transform, const AABB& clip) const
+{
+    return AABB::Intersect(GetAABB(transform), clip);
+}
+
+bool Circle::IntersectHit(const Ray &ray, float tMax, HitRecord* hit) const
+{
+    RENDER_STAT_ADD(PrimitiveTests, 1);
     auto l = ray.Origin;
     float a = glm::dot(ray.Direction, ray.Direction);
     float b = 2.0f * glm::dot(l, ray.Direction);
     float c = glm::dot(l,l) - m_Radius * m_Radius;
 
     float discriminant = b * b - 4.0f * a * c;
+    if (discriminant < 0.0f)
+        return false;
 
-    if (discriminant >= 0.0f)
+    // t0 <= t1, the near root is a front face hit and the far one a hit from inside
+    float t0 = (-b - sqrtf(discriminant)) / (2.0f * a);
+    float t1 = (-b + sqrtf(discriminant)) / (2.0f * a);
+    float t;
+    bool frontFace;
+    if (t0 >= shapeTMin)
     {
-        float t1 = (-b + sqrtf(discriminant)) / 2 * a;
-        float t2 = (-b - sqrtf(discriminant)) / 2 * a;
-        float t = 0.0f;
-
-        intersect->HasIntersection = true;
-        if (t1 >= tMin && t2 >= tMin)
-        {
-            t = t1 < t2 ? t1 : t2;
-            intersect->IsFrontFace = true;
-        }
-        else if (t1 >= tMin)
-        {
-            t = t1;
-            intersect->IsFrontFace = false;
-        }
-        else if (t2 >= tMin)
-        {
-            t = t2;
-            intersect->IsFrontFace = false;
-        }
-        else
-        {
-            intersect->HasIntersection = false;
-        }
-        auto intersectPoint = ray.Origin + ray.Direction * t;
-        auto normal = glm::normalize(intersectPoint);
-        if (!intersect->IsFrontFace)
-            normal *= -1.0f;
-        intersect->Position = intersectPoint;
-        intersect->Normal = normal;
+        t = t0;
+        frontFace = true;
+    }
+    else if (t1 >= shapeTMin)
+    {
+        t = t1;
+        frontFace = false;
     }
     else
     {
-        intersect->HasIntersection = false;
+        return false;
     }
 
+    if (t >= tMax)
+        return false;
+
+    hit->T = t;
+    hit->IsFrontFace = frontFace;
+    return true;
+}
+
+void Circle::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    auto intersectPoint = ray.Origin + ray.Direction * hit.T;
+    auto normal = glm::normalize(intersectPoint);
+
+    // Longitude around y for u, polar angle from +y for v
+    constexpr float invPi = 0.318309886184f;
+    float phi = atan2f(normal.z, normal.x);
+    float theta = acosf(glm::clamp(normal.y, -1.0f, 1.0f));
+    intersect->UV = glm::vec2{ phi * 0.5f * invPi + 0.5f, theta * invPi };
+    intersect->Tangent = OrthogonalizeTangent(glm::vec3{ -normal.z, 0.0f, normal.x }, normal);
+
+    intersect->HasIntersection = true;
+    intersect->IsFrontFace = hit.IsFrontFace;
+    intersect->Position = intersectPoint;
+    intersect->Normal = hit.IsFrontFace ? normal : -normal;
 }
 
 AABB Circle::GetAABB(Transform* transform) const
@@ -59,38 +125,42 @@ AABB Circle::GetAABB(Transform* transform) const
     }.TransformAndBound(transform);
 }
 
-void Quad::Intersect(const Ray& ray, SurfaceInteraction* intersect) const
+bool Quad::IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const
 {
+    RENDER_STAT_ADD(PrimitiveTests, 1);
     if (fabs(ray.Direction.y) < 1e-8f)
-    {
-        intersect->HasIntersection = false;
-        return;
-    }
+        return false;
 
     auto t = -ray.Origin.y / ray.Direction.y;
+    if (t <= shapeTMin || t >= tMax)
+        return false;
 
     auto p = ray.Origin + ray.Direction * t;
 
     float halfWidth = m_Width / 2.0f;
     float halfHeight = m_Height / 2.0f;
+    if (p.x * p.x >= halfWidth * halfWidth || p.z * p.z >= halfHeight * halfHeight)
+        return false;
 
-    if (t > tMin && (p.x * p.x < halfWidth * halfWidth) && (p.z * p.z < halfHeight * halfHeight))
-    {
-        intersect->HasIntersection = true;
-        intersect->Position = p;
-        intersect->IsFrontFace = ray.Origin.y > 0.0f;
-        intersect->Normal = intersect->IsFrontFace ? m_Normal : -m_Normal;
-    }
-    else
-    {
-        intersect->HasIntersection = false;
-    }
+    hit->T = t;
+    return true;
+}
+
+void Quad::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    auto p = ray.Origin + ray.Direction * hit.T;
+    intersect->HasIntersection = true;
+    intersect->Position = p;
+    intersect->IsFrontFace = ray.Origin.y > 0.0f;
+    intersect->Normal = intersect->IsFrontFace ? m_Normal : -m_Normal;
+    intersect->UV = glm::vec2{ p.x / m_Width + 0.5f, p.z / m_Height + 0.5f };
+    intersect->Tangent = glm::vec3{ 1.0f, 0.0f, 0.0f };
 }
 
 AABB Quad::GetAABB(Transform* transform) const
 {
-    glm::vec3 min;
-    glm::vec3 max;
+    glm::vec3 min{ std::numeric_limits<float>::max() };
+    glm::vec3 max{ std::numeric_limits<float>::lowest() };
 
     glm::vec3 v[4] = {
         TransformPoint(transform->GetMat(), glm::vec3{  m_Width / 2.0f, 0.0f,  m_Height / 2.0f }),
@@ -108,37 +178,26 @@ AABB Quad::GetAABB(Transform* transform) const
     return AABB{ min, max };
 }
 
-void Triangle::Intersect(const Ray& ray, SurfaceInteraction* intersect) const
+AABB Quad::GetClippedAABB(Transform* transform, const AABB& clip) const
 {
-    const auto& P0 = m_Vertices[0];
-    const auto& P1 = m_Vertices[1];
-    const auto& P2 = m_Vertices[2];
-    const auto& N0 = m_Normals[0];
-    const auto& N1 = m_Normals[1];
-    const auto& N2 = m_Normals[2];
-    auto S = ray.Origin - P0;
-    auto E1 = P1 - P0;
-    auto E2 = P2 - P0;
-    auto S1 = glm::cross(ray.Direction, E2);
-    auto S2 = glm::cross(S, E1);
-
-    auto divisor = glm::dot(S1, E1);
-    if (divisor == 0)
-    {
-        return;
-    }
-
-    auto t = glm::dot(S2, E2) / divisor;
-    auto b1 = glm::dot(S1, S) / divisor;
-    auto b2 = glm::dot(S2, ray.Direction) / divisor;
+    glm::vec3 v[4] = {
+        TransformPoint(transform->GetMat(), glm::vec3{  m_Width / 2.0f, 0.0f,  m_Height / 2.0f }),
+        TransformPoint(transform->GetMat(), glm::vec3{  m_Width / 2.0f, 0.0f, -m_Height / 2.0f }),
+        TransformPoint(transform->GetMat(), glm::vec3{ -m_Width / 2.0f, 0.0f, -m_Height / 2.0f }),
+        TransformPoint(transform->GetMat(), glm::vec3{ -m_Width / 2.0f, 0.0f,  m_Height / 2.0f }),
+    };
 
-    if (t < tMin || b1 < 0.0f || b2 < 0.0f || b1 + b2 > 1.0f)
-    {
-        return;
-    }
+    return ClipPolygonBounds(v, 4, clip);
+}
 
-    intersect->Position = (1 - b1 - b2) * P0 + b1 * P1 + b2 * P2;
-    intersect->Normal = (1 - b1 - b2) * N0 + b1 * N1 + b2 * N2;
+void ComputeTriangleInteraction(
+    const glm::vec3 vertices[3], const glm::vec3 normals[3], const glm::vec2 uvs[3], 
+    const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect)
+{
+    float b0 = 1 - hit.B1 - hit.B2;
+    intersect->Position = b0 * vertices[0] + hit.B1 * vertices[1] + hit.B2 * vertices[2];
+    intersect->Normal = b0 * normals[0] + hit.B1 * normals[1] + hit.B2 * normals[2];
+    intersect->UV = b0 * uvs[0] + hit.B1 * uvs[1] + hit.B2 * uvs[2];
     intersect->HasIntersection = true;
     if (glm::dot(intersect->Normal, ray.Direction) > 0.0f)
     {
@@ -149,23 +208,119 @@ void Triangle::Intersect(const Ray& ray, SurfaceInteraction* intersect) const
     {
         intersect->IsFrontFace = true;
     }
+
+    // dP/du from the UV parameterization, meshes without UVs get the first edge
+    auto dp02 = vertices[0] - vertices[2];
+    auto dp12 = vertices[1] - vertices[2];
+    auto duv02 = uvs[0] - uvs[2];
+    auto duv12 = uvs[1] - uvs[2];
+    float determinant = duv02.x * duv12.y - duv02.y * duv12.x;
+    auto dpdu = fabs(determinant) > 1e-8f ?
+        (duv12.y * dp02 - duv02.y * dp12) / determinant :
+        vertices[1] - vertices[0];
+    intersect->Tangent = OrthogonalizeTangent(dpdu, glm::normalize(intersect->Normal));
 }
 
-AABB Triangle::GetAABB(Transform* transform) const
+AABB GetTriangleAABB(const glm::vec3 vertices[3], Transform* transform)
 {
     AABB bound;
+    for (int i = 0; i < 3; i++)
+    {
+        auto v = TransformPoint(transform->GetMat(), vertices[i]);
+        bound.Min = glm::min(bound.Min, v);
+        bound.Max = glm::max(bound.Max, v);
+    }
+
+    return bound;
+}
 
+AABB GetClippedTriangleAABB(const glm::vec3 vertices[3], Transform* transform, const AABB& clip)
+{
     glm::vec3 v[3] = {
-        TransformPoint(transform->GetMat(), m_Vertices[0]),
-        TransformPoint(transform->GetMat(), m_Vertices[1]),
-        TransformPoint(transform->GetMat(), m_Vertices[2]),
+        TransformPoint(transform->GetMat(), vertices[0]),
+        TransformPoint(transform->GetMat(), vertices[1]),
+        TransformPoint(transform->GetMat(), vertices[2]),
     };
 
+    return ClipPolygonBounds(v, 3, clip);
+}
+
+bool Triangle::IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const
+{
+    return IntersectHit(ray, RayShear(ray.Direction), tMax, hit);
+}
+
+bool Triangle::IntersectHit(const Ray& ray, const RayShear& shear, float tMax, HitRecord* hit) const
+{
+    RENDER_STAT_ADD(PrimitiveTests, 1);
+    return IntersectTriangleWatertight(ray, shear, m_Vertices[0], m_Vertices[1], m_Vertices[2], 
+        shapeTMin, tMax, &hit->T, &hit->B1, &hit->B2);
+}
+
+void Triangle::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    ComputeTriangleInteraction(m_Vertices, m_Normals, m_UVs, ray, hit, intersect);
+}
+
+AABB Triangle::GetAABB(Transform* transform) const
+{
+    return GetTriangleAABB(m_Vertices, transform);
+}
+
+AABB Triangle::GetClippedAABB(Transform* transform, const AABB& clip) const
+{
+    return GetClippedTriangleAABB(m_Vertices, transform, clip);
+}
+
+bool MeshTriangle::IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const
+{
+    return IntersectHit(ray, RayShear(ray.Direction), tMax, hit);
+}
+
+bool MeshTriangle::IntersectHit(const Ray& ray, const RayShear& shear, float tMax, HitRecord* hit) const
+{
+    RENDER_STAT_ADD(PrimitiveTests, 1);
+    return IntersectTriangleWatertight(ray, shear, GetVertex(0), GetVertex(1), GetVertex(2), 
+        shapeTMin, tMax, &hit->T, &hit->B1, &hit->B2);
+}
+
+void MeshTriangle::ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const
+{
+    const auto& meshVertices = m_Mesh->GetVertices();
+    const auto& meshNormals = m_Mesh->GetNormals();
+    const auto& meshTexCoords = m_Mesh->GetTexCoords();
+    const uint32_t* indices = &m_Mesh->GetIndices()[3 * m_Index];
+
+    glm::vec3 vertices[3], normals[3];
+    glm::vec2 uvs[3];
     for (int i = 0; i < 3; i++)
     {
-        bound.Min = glm::min(bound.Min, v[i]);
-        bound.Max = glm::max(bound.Max, v[i]);
+        vertices[i] = meshVertices[indices[i]];
+        uvs[i] = meshTexCoords.size() == meshVertices.size() ? meshTexCoords[indices[i]] : glm::vec2{ 0.0f };
     }
 
-    return bound;
+    // Face normals for meshes without vertex normals, like TriangleList
+    if (meshNormals.size() == meshVertices.size())
+    {
+        for (int i = 0; i < 3; i++)
+            normals[i] = meshNormals[indices[i]];
+    }
+    else
+    {
+        normals[0] = normals[1] = normals[2] = glm::normalize(glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+    }
+
+    ComputeTriangleInteraction(vertices, normals, uvs, ray, hit, intersect);
+}
+
+AABB MeshTriangle::GetAABB(Transform* transform) const
+{
+    glm::vec3 vertices[3] = { GetVertex(0), GetVertex(1), GetVertex(2) };
+    return GetTriangleAABB(vertices, transform);
+}
+
+AABB MeshTriangle::GetClippedAABB(Transform* transform, const AABB& clip) const
+{
+    glm::vec3 vertices[3] = { GetVertex(0), GetVertex(1), GetVertex(2) };
+    return GetClippedTriangleAABB(vertices, transform, clip);
 }
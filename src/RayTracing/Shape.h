@@ -1,27 +1,139 @@
 #pragma once
 
 #include "Geometry.h"
+#include "core/Mesh.h"
+#include <cstdint>
+#include <limits>
 #include <memory>
 
 
-class Material;
+// Index into the MaterialTable of the scene
+using MaterialID = uint16_t;
 
+// Hits closer than this, in object space, are ignored so rays leaving a
+// surface do not hit it again
+constexpr static float shapeTMin = 0.001f;
+
+enum class ShapeType : uint8_t
+{
+    Triangle,
+    MeshTriangle,
+    Circle,
+    Quad,
+    InstancedMesh
+};
+
+// What the closest hit search keeps per candidate. The surface is only
+// evaluated into a SurfaceInteraction for the final hit.
+struct HitRecord
+{
+    // Along the direction of the queried ray, which need not be normalized
+    float T = std::numeric_limits<float>::max();
+    // Set by containers, the reference index in a BVH
+    uint32_t PrimitiveIndex = 0;
+    // Barycentric weights of vertex 1 and 2 on triangles
+    float B1 = 0.0f, B2 = 0.0f;
+    // Inside hits on circles
+    bool IsFrontFace = false;
+    // Part of a shape made of many, the triangle of an instanced mesh
+    uint32_t ElementIndex = 0;
+};
+
+// Shading record of a hit
 struct SurfaceInteraction
 {
     glm::vec3 Position{ 0.0f };
     glm::vec3 Normal{ 0.0f, 0.0f, 0.0f };
+    // Unit dP/du made orthogonal to Normal
+    glm::vec3 Tangent{ 0.0f };
+    glm::vec2 UV{ 0.0f };
     bool HasIntersection = false;
     bool IsFrontFace = false;
-    Material* Material = nullptr;
+    MaterialID MaterialIndex = 0;
 };
 
+// Watertight ray/triangle test, rays through a shared edge or vertex hit at
+// least one of the triangles. Hits with t in [tMin, tMax) along ray.Direction
+// return true with the barycentric weights of v1 and v2.
+inline bool IntersectTriangleWatertight(
+    const Ray& ray, const RayShear& shear,
+    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2,
+    float tMin, float tMax, float* t, float* b1, float* b2)
+{
+    auto a = v0 - ray.Origin;
+    auto b = v1 - ray.Origin;
+    auto c = v2 - ray.Origin;
+
+    float ax = a[shear.Kx] - shear.Sx * a[shear.Kz];
+    float ay = a[shear.Ky] - shear.Sy * a[shear.Kz];
+    float bx = b[shear.Kx] - shear.Sx * b[shear.Kz];
+    float by = b[shear.Ky] - shear.Sy * b[shear.Kz];
+    float cx = c[shear.Kx] - shear.Sx * c[shear.Kz];
+    float cy = c[shear.Ky] - shear.Sy * c[shear.Kz];
+
+    // Scaled barycentrics, the signed areas of the edges seen from the ray
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+
+    // Exactly on an edge in float, redo the edge in double so neighbours agree
+    if (u == 0.0f || v == 0.0f || w == 0.0f)
+    {
+        u = (float)((double)cx * by - (double)cy * bx);
+        v = (float)((double)ax * cy - (double)ay * cx);
+        w = (float)((double)bx * ay - (double)by * ax);
+    }
+
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return false;
+
+    float det = u + v + w;
+    if (det == 0.0f)
+        return false;
+
+    float az = shear.Sz * a[shear.Kz];
+    float bz = shear.Sz * b[shear.Kz];
+    float cz = shear.Sz * c[shear.Kz];
+    float invDet = 1.0f / det;
+    float hitT = (u * az + v * bz + w * cz) * invDet;
+    if (!(hitT >= tMin && hitT < tMax))
+        return false;
+
+    *t = hitT;
+    *b1 = v * invDet;
+    *b2 = w * invDet;
+    return true;
+}
+
+// Surface and bounds of a triangle from its corners, shared by the triangle
+// shapes whatever they store
+void ComputeTriangleInteraction(
+    const glm::vec3 vertices[3], const glm::vec3 normals[3], const glm::vec2 uvs[3], 
+    const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect);
+AABB GetTriangleAABB(const glm::vec3 vertices[3], Transform* transform);
+AABB GetClippedTriangleAABB(const glm::vec3 vertices[3], Transform* transform, const AABB& clip);
+
 class Shape
 {
 public:
     Shape() {};
-    virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) const = 0;
+    virtual ShapeType GetType() const = 0;
+    // Closest hit in [shapeTMin, tMax), fills the T and shape fields of hit
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const = 0;
+    // Evaluates the surface at a hit found by IntersectHit with the same ray
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const = 0;
+    void Intersect(const Ray& ray, SurfaceInteraction* intersect) const
+    {
+        HitRecord hit;
+        if (IntersectHit(ray, std::numeric_limits<float>::max(), &hit))
+            ComputeInteraction(ray, hit, intersect);
+        else
+            intersect->HasIntersection = false;
+    }
     // TODO: Add Transform parameter
     virtual AABB GetAABB(Transform* transform) const = 0;
+    // Bounds of the part of the shape inside clip, used by spatial BVH splits
+    virtual AABB GetClippedAABB(Transform* transform, const AABB& clip) const;
 };
 
 class Circle : public Shape
@@ -29,7 +141,10 @@ class Circle : public Shape
 public:
     Circle(float radius=1.0f) : m_Radius(radius), Shape() {};
 
-    virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) const override;
+    virtual ShapeType GetType() const override  { return ShapeType::Circle; }
+    float GetRadius() const                     { return m_Radius; }
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const override;
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const override;
     virtual AABB GetAABB(Transform* transform) const override;
     
     private:
@@ -41,8 +156,14 @@ class Quad : public Shape
     public:
     Quad(float width=1.0f, float height=1.0f) : m_Width(width), m_Height(height) {}
     
-    virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) const override;
+    virtual ShapeType GetType() const override  { return ShapeType::Quad; }
+    // Centered on the origin in the y = 0 plane, width along x and height along z
+    float GetWidth() const                      { return m_Width; }
+    float GetHeight() const                     { return m_Height; }
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const override;
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const override;
     virtual AABB GetAABB(Transform* transform) const override;
+    virtual AABB GetClippedAABB(Transform* transform, const AABB& clip) const override;
 
 private:
     float m_Width;
@@ -79,11 +200,42 @@ public:
         m_UVs[2] = uv2;
     }
 
-    virtual void Intersect(const Ray& ray, SurfaceInteraction* intersect) const override;
+    virtual ShapeType GetType() const override  { return ShapeType::Triangle; }
+    const glm::vec3& GetVertex(int i) const     { return m_Vertices[i]; }
+    const glm::vec3& GetNormal(int i) const     { return m_Normals[i]; }
+    const glm::vec2& GetUV(int i) const         { return m_UVs[i]; }
+
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const override;
+    // For loops over many triangles with one ray, shear is computed once
+    bool IntersectHit(const Ray& ray, const RayShear& shear, float tMax, HitRecord* hit) const;
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const override;
     virtual AABB GetAABB(Transform* transform) const override;
+    virtual AABB GetClippedAABB(Transform* transform, const AABB& clip) const override;
 
 private:
     glm::vec3 m_Vertices[3];
     glm::vec3 m_Normals[3];
     glm::vec2 m_UVs[3];
-};
\ No newline at end of file
+};
+
+// Triangle of a mesh shared with other placements, only the mesh and the
+// triangle number are stored
+class MeshTriangle : public Shape
+{
+public:
+    // mesh must outlive the triangle
+    MeshTriangle(const Mesh* mesh, uint32_t index) : m_Mesh(mesh), m_Index(index) {}
+
+    virtual ShapeType GetType() const override  { return ShapeType::MeshTriangle; }
+    const glm::vec3& GetVertex(int i) const     { return m_Mesh->GetVertices()[m_Mesh->GetIndices()[3 * m_Index + i]]; }
+
+    virtual bool IntersectHit(const Ray& ray, float tMax, HitRecord* hit) const override;
+    bool IntersectHit(const Ray& ray, const RayShear& shear, float tMax, HitRecord* hit) const;
+    virtual void ComputeInteraction(const Ray& ray, const HitRecord& hit, SurfaceInteraction* intersect) const override;
+    virtual AABB GetAABB(Transform* transform) const override;
+    virtual AABB GetClippedAABB(Transform* transform, const AABB& clip) const override;
+
+private:
+    const Mesh* m_Mesh;
+    uint32_t m_Index;
+};
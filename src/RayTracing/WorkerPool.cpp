@@ -0,0 +1,87 @@
+#include "WorkerPool.h"
+#include "core/Trace.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(const char* name, uint32_t threadCount)
+{
+    threadCount = std::max(threadCount, 1u);
+    m_Threads.reserve(threadCount - 1);
+    for (uint32_t i = 1; i < threadCount; i++)
+        m_Threads.emplace_back([this, name, i]() { WorkerLoop(name, i); });
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Exit = true;
+    }
+    m_WorkReady.notify_all();
+    for (auto& thread : m_Threads)
+        thread.join();
+}
+
+void WorkerPool::ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& func)
+{
+    if (count == 0)
+        return;
+
+    if (m_Threads.empty() || count == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            func(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Func = &func;
+        m_TaskCount = count;
+        m_NextTask.store(0, std::memory_order_relaxed);
+        m_BusyWorkers = (uint32_t)m_Threads.size();
+        m_Generation++;
+    }
+    m_WorkReady.notify_all();
+
+    RunTasks(0);
+
+    // Every worker checks in, none may still hold a pointer to func
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_WorkDone.wait(lock, [this]() { return m_BusyWorkers == 0; });
+    m_Func = nullptr;
+}
+
+void WorkerPool::WorkerLoop(const char* name, uint32_t worker)
+{
+    // Only labels the timeline, unused in builds without tracing
+    (void)name;
+    TRACE_THREAD_NAME(name);
+    uint64_t generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_WorkReady.wait(lock, [&]() { return m_Exit || m_Generation != generation; });
+            if (m_Exit)
+                return;
+            generation = m_Generation;
+        }
+
+        RunTasks(worker);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            last = --m_BusyWorkers == 0;
+        }
+        if (last)
+            m_WorkDone.notify_one();
+    }
+}
+
+void WorkerPool::RunTasks(uint32_t worker)
+{
+    uint32_t task;
+    while ((task = m_NextTask.fetch_add(1, std::memory_order_relaxed)) < m_TaskCount)
+        (*m_Func)(task, worker);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept alive between parallel loops. Meant for work split into many
+// short passes per frame, where starting a thread per pass would cost as much
+// as the pass itself.
+class WorkerPool
+{
+public:
+    // threadCount includes the calling thread, which runs tasks too. name
+    // labels the timeline rows of the workers and must be a string literal.
+    explicit WorkerPool(const char* name, uint32_t threadCount = std::thread::hardware_concurrency());
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    uint32_t GetThreadCount() const { return (uint32_t)m_Threads.size() + 1; }
+
+    // Calls func(i, worker) for every i in [0, count) and returns once all
+    // calls finished. worker is below GetThreadCount() and no two calls run
+    // with the same one at once, the caller is worker 0. Tasks are handed out
+    // one at a time, so uneven tasks balance. Not reentrant, only one thread
+    // may call it at a time.
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t /* task */, uint32_t /* worker */)>& func);
+
+private:
+    void WorkerLoop(const char* name, uint32_t worker);
+    void RunTasks(uint32_t worker);
+
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkReady;
+    std::condition_variable m_WorkDone;
+    // Written under the mutex before m_Generation changes
+    const std::function<void(uint32_t, uint32_t)>* m_Func = nullptr;
+    uint32_t m_TaskCount = 0;
+    uint32_t m_BusyWorkers = 0;
+    uint64_t m_Generation = 0;
+    bool m_Exit = false;
+
+    std::atomic<uint32_t> m_NextTask{ 0 };
+};
@@ -0,0 +1,362 @@
+// Intersection kernel and BVH microbenchmarks.
+//
+// Every assets/*.ply mesh is loaded in name order and gets three fixed ray
+// sets: coherent primary rays from a pinhole in front of the mesh, diffuse
+// bounce rays leaving the primary hits in cosine distributed directions, and
+// shadow rays from the primary hits towards a point light above the mesh.
+// All randomness comes from hashes of the ray index, so the sets are the same
+// on every run and every machine.
+//
+// Results are one line per measurement, the minimum over the repeats:
+//
+//   <group> <mesh> <subject> <ray set> <value> <unit> <hits>
+//
+// Lines only change when the measured numbers do, so two runs can be diffed
+// across commits. The last column is a checksum, the hit count for ray
+// queries and the primitive reference count for builds. It catches kernels
+// that got faster by getting wrong.
+
+#include "RayTracing/BVH.h"
+#include "RayTracing/Math.h"
+#include "RayTracing/Sampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+constexpr static uint32_t primaryRaysX = 256;
+constexpr static uint32_t primaryRaysY = 256;
+constexpr static int defaultRepeatCount = 5;
+// Ray origins on a surface are pushed off it by this fraction of the mesh size
+constexpr static float surfaceOffset = 1e-4f;
+
+struct RaySet
+{
+    explicit RaySet(const std::string& name) : Name(name) {}
+
+    std::string Name;
+    std::vector<Ray> Rays;
+};
+
+struct BenchmarkMesh
+{
+    std::string Name;
+    // The primitives reference its arrays
+    std::shared_ptr<const Mesh> Source;
+    std::vector<std::shared_ptr<SimplePrimitive>> Primitives;
+    // Object space copies for the kernel benchmarks
+    std::vector<Triangle> Triangles;
+    std::vector<AABB> TriangleBounds;
+    AABB Bounds;
+    std::vector<RaySet> RaySets;
+};
+
+class Results
+{
+public:
+    void Add(const char* group, const std::string& mesh, const std::string& subject, const std::string& raySet,
+        double value, const char* unit, uint32_t hits)
+    {
+        char line[256];
+        std::snprintf(line, sizeof(line), "%-9s %-12s %-22s %-8s %12.3f %-6s %u",
+            group, mesh.c_str(), subject.c_str(), raySet.c_str(), value, unit, hits);
+        std::cout << line << std::endl;
+        m_Lines.push_back(line);
+    }
+
+    void Write(const std::string& path) const
+    {
+        std::ofstream file(path);
+        for (const auto& line : m_Lines)
+            file << line << "\n";
+    }
+
+private:
+    std::vector<std::string> m_Lines;
+};
+
+static float HashFloat(uint64_t a, uint64_t b, uint64_t c)
+{
+    return (float)(Hash(a, b, c) >> 40) * 0x1p-24f;
+}
+
+// Runs func repeatCount times and returns the fastest run in ms
+template<typename Func>
+static double TimeMin(int repeatCount, Func func)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeatCount; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+static void GenerateRaySets(BenchmarkMesh& mesh)
+{
+    auto center = 0.5f * (mesh.Bounds.Min + mesh.Bounds.Max);
+    auto extent = mesh.Bounds.Max - mesh.Bounds.Min;
+    float radius = 0.5f * glm::length(extent);
+
+    // Pinhole on the +z side looking down -z, the image plane covers the
+    // bounding sphere
+    RaySet primary("primary");
+    auto eye = center + glm::vec3{ 0.0f, 0.0f, 3.0f * radius };
+    for (uint32_t y = 0; y < primaryRaysY; y++)
+    {
+        for (uint32_t x = 0; x < primaryRaysX; x++)
+        {
+            float u = ((float)x + 0.5f) / primaryRaysX * 2.0f - 1.0f;
+            float v = ((float)y + 0.5f) / primaryRaysY * 2.0f - 1.0f;
+            Ray ray;
+            ray.Origin = eye;
+            ray.Direction = glm::normalize(center + glm::vec3{ u * radius, v * radius, 0.0f } - eye);
+            primary.Rays.push_back(ray);
+        }
+    }
+
+    // Secondary rays start at the primary hits, found with a throwaway BVH
+    BVHBuildOptions options;
+    options.SplitMethod = BVHSplitMethod::SAH;
+    BVH bvh(mesh.Primitives, options);
+
+    RaySet diffuse("diffuse");
+    RaySet shadow("shadow");
+    auto lightPosition = center + glm::vec3{ 0.0f, 2.0f * radius, radius };
+    for (size_t i = 0; i < primary.Rays.size(); i++)
+    {
+        SurfaceInteraction intersect;
+        bvh.Intersect(primary.Rays[i], &intersect);
+        if (!intersect.HasIntersection)
+            continue;
+
+        auto normal = glm::normalize(intersect.Normal);
+        if (glm::dot(normal, primary.Rays[i].Direction) > 0.0f)
+            normal = -normal;
+        auto origin = intersect.Position + normal * (surfaceOffset * radius);
+
+        Ray bounce;
+        bounce.Origin = origin;
+        auto sphere = SampleUniformSphere({ HashFloat(1, i, 0), HashFloat(1, i, 1) });
+        bounce.Direction = normal + sphere;
+        if (glm::dot(bounce.Direction, bounce.Direction) < 1e-8f)
+            bounce.Direction = normal;
+        bounce.Normalize();
+        diffuse.Rays.push_back(bounce);
+
+        // The BVH has no any-hit query, shadow rays are closest hit rays
+        // that mostly start facing the light
+        Ray toLight;
+        toLight.Origin = origin;
+        toLight.Direction = glm::normalize(lightPosition - origin);
+        shadow.Rays.push_back(toLight);
+    }
+
+    mesh.RaySets.push_back(std::move(primary));
+    mesh.RaySets.push_back(std::move(diffuse));
+    mesh.RaySets.push_back(std::move(shadow));
+}
+
+static bool LoadMesh(const std::filesystem::path& path, BenchmarkMesh& mesh)
+{
+    auto source = std::make_shared<Mesh>(path.string());
+    const auto& vertices = source->GetVertices();
+    const auto& indices = source->GetIndices();
+    if (indices.empty())
+        return false;
+
+    mesh.Name = path.stem().string();
+    mesh.Source = source;
+    TriangleList triangleList(source, std::make_shared<LambertianMaterial>(glm::vec3{ 1.0f }));
+    mesh.Primitives = triangleList.GetPrimitives();
+
+    Transform identity;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const auto& v0 = vertices[indices[i + 0]];
+        const auto& v1 = vertices[indices[i + 1]];
+        const auto& v2 = vertices[indices[i + 2]];
+        auto normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+        mesh.Triangles.emplace_back(v0, v1, v2, normal, normal, normal,
+            glm::vec2{ 0.0f }, glm::vec2{ 0.0f }, glm::vec2{ 0.0f });
+        mesh.TriangleBounds.push_back(mesh.Triangles.back().GetAABB(&identity));
+        mesh.Bounds = AABB::Union(mesh.Bounds, mesh.TriangleBounds.back());
+    }
+
+    GenerateRaySets(mesh);
+    return true;
+}
+
+// Every ray is tested against one shape, ray i against shape i modulo the
+// shape count, so the kernel sees the hit rate and memory traffic of a leaf
+// test rather than one cached primitive
+template<typename Test>
+static void BenchmarkKernel(Results& results, const BenchmarkMesh& mesh, const char* subject, int repeatCount, Test test)
+{
+    for (const auto& raySet : mesh.RaySets)
+    {
+        uint32_t hits = 0;
+        double ms = TimeMin(repeatCount, [&]() {
+            hits = 0;
+            for (size_t i = 0; i < raySet.Rays.size(); i++)
+                hits += test(raySet.Rays[i], i) ? 1 : 0;
+        });
+        results.Add("kernel", mesh.Name, subject, raySet.Name, ms * 1e6 / std::max<size_t>(1, raySet.Rays.size()), "ns/ray", hits);
+    }
+}
+
+static void BenchmarkKernels(Results& results, const BenchmarkMesh& mesh, int repeatCount)
+{
+    const auto& triangles = mesh.Triangles;
+    BenchmarkKernel(results, mesh, "Triangle::Intersect", repeatCount, [&](const Ray& ray, size_t i) {
+        SurfaceInteraction intersect;
+        triangles[i % triangles.size()].Intersect(ray, &intersect);
+        return intersect.HasIntersection;
+    });
+
+    const auto& bounds = mesh.TriangleBounds;
+    BenchmarkKernel(results, mesh, "AABB::IntersectP", repeatCount, [&](const Ray& ray, size_t i) {
+        return bounds[i % bounds.size()].IntersectP(ray);
+    });
+
+    // Circle and Quad sit at the origin in object space, they are sized to
+    // the mesh and the rays are moved into their space
+    auto center = 0.5f * (mesh.Bounds.Min + mesh.Bounds.Max);
+    auto extent = mesh.Bounds.Max - mesh.Bounds.Min;
+    auto toObject = [&](const Ray& ray) {
+        Ray local = ray;
+        local.Origin -= center;
+        return local;
+    };
+
+    Circle circle(0.5f * std::max(extent.x, std::max(extent.y, extent.z)));
+    BenchmarkKernel(results, mesh, "Circle::Intersect", repeatCount, [&](const Ray& ray, size_t) {
+        SurfaceInteraction intersect;
+        circle.Intersect(toObject(ray), &intersect);
+        return intersect.HasIntersection;
+    });
+
+    Quad quad(extent.x, extent.z);
+    BenchmarkKernel(results, mesh, "Quad::Intersect", repeatCount, [&](const Ray& ray, size_t) {
+        SurfaceInteraction intersect;
+        quad.Intersect(toObject(ray), &intersect);
+        return intersect.HasIntersection;
+    });
+}
+
+struct BVHConfig
+{
+    const char* Name;
+    BVHSplitMethod SplitMethod;
+    bool CompactNodes;
+};
+
+constexpr static BVHConfig bvhConfigs[] = {
+    { "EqualCounts", BVHSplitMethod::EqualCounts, false },
+    { "SAH", BVHSplitMethod::SAH, false },
+    { "SAH-compact", BVHSplitMethod::SAH, true },
+    { "SBVH", BVHSplitMethod::SBVH, false },
+};
+
+static void BenchmarkBVH(Results& results, const BenchmarkMesh& mesh, int repeatCount)
+{
+    for (const auto& config : bvhConfigs)
+    {
+        BVHBuildOptions options;
+        options.SplitMethod = config.SplitMethod;
+        options.CompactNodes = config.CompactNodes;
+
+        std::unique_ptr<BVH> bvh;
+        double buildMs = TimeMin(repeatCount, [&]() { bvh = std::make_unique<BVH>(mesh.Primitives, options); });
+        results.Add("build", mesh.Name, config.Name, "-", buildMs, "ms", (uint32_t)bvh->GetReferenceCount());
+
+        for (const auto& raySet : mesh.RaySets)
+        {
+            uint32_t hits = 0;
+            double ms = TimeMin(repeatCount, [&]() {
+                hits = 0;
+                for (const auto& ray : raySet.Rays)
+                {
+                    SurfaceInteraction intersect;
+                    bvh->Intersect(ray, &intersect);
+                    hits += intersect.HasIntersection ? 1 : 0;
+                }
+            });
+            results.Add("intersect", mesh.Name, config.Name, raySet.Name,
+                ms * 1e6 / std::max<size_t>(1, raySet.Rays.size()), "ns/ray", hits);
+        }
+    }
+}
+
+static void PrintUsage()
+{
+    std::cout << "Usage: PBRmanBench [--assets <dir>] [--repeat <count>] [--mesh <name>] [--output <file>]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string assetsDirectory = RUNTIME_DIRECTORY "assets";
+    std::string meshFilter;
+    std::string outputPath;
+    int repeatCount = defaultRepeatCount;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--assets") && hasValue)
+            assetsDirectory = argv[++i];
+        else if (!std::strcmp(argv[i], "--repeat") && hasValue)
+            repeatCount = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--mesh") && hasValue)
+            meshFilter = argv[++i];
+        else if (!std::strcmp(argv[i], "--output") && hasValue)
+            outputPath = argv[++i];
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::vector<std::filesystem::path> meshPaths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(assetsDirectory, error))
+    {
+        const auto& path = entry.path();
+        if (path.extension() == ".ply" && (meshFilter.empty() || path.stem().string() == meshFilter))
+            meshPaths.push_back(path);
+    }
+    if (meshPaths.empty())
+    {
+        std::cout << "No .ply meshes found in " << assetsDirectory << std::endl;
+        return 1;
+    }
+    std::sort(meshPaths.begin(), meshPaths.end());
+
+    // Mesh loading logs, so every mesh is loaded before the first result line
+    std::vector<BenchmarkMesh> meshes;
+    for (const auto& path : meshPaths)
+    {
+        BenchmarkMesh mesh;
+        if (LoadMesh(path, mesh))
+            meshes.push_back(std::move(mesh));
+    }
+
+    Results results;
+    std::cout << "# group     mesh         subject                ray set         value unit   hits" << std::endl;
+    for (const auto& mesh : meshes)
+    {
+        BenchmarkKernels(results, mesh, repeatCount);
+        BenchmarkBVH(results, mesh, repeatCount);
+    }
+
+    if (!outputPath.empty())
+        results.Write(outputPath);
+    return 0;
+}
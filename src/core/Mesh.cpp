@@ -19,7 +19,7 @@ static inline std::vector<uint8_t> read_file_binary(const std::string & pathToFi
     return fileBufferBytes;
 }
 
-Mesh::Mesh(const std::string& plyFIlePath)
+Mesh::Mesh(const std::string& plyFIlePath, uint32_t attributes)
         : m_PlyFilePath(plyFIlePath)
 {
     std::cout << "........................................................................\n";
@@ -75,11 +75,17 @@ Mesh::Mesh(const std::string& plyFIlePath)
         // The header information can be used to programmatically extract properties on elements
         // known to exist in the header prior to reading the data. For brevity of this sample, properties 
         // like vertex position are hard-coded: 
-        try { vertices = file.request_properties_from_element("vertex", { "x", "y", "z" }); }
-        catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        if (attributes & MeshPositions)
+        {
+            try { vertices = file.request_properties_from_element("vertex", { "x", "y", "z" }); }
+            catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        }
 
-        try { normals = file.request_properties_from_element("vertex", { "nx", "ny", "nz" }); }
-        catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        if (attributes & MeshNormals)
+        {
+            try { normals = file.request_properties_from_element("vertex", { "nx", "ny", "nz" }); }
+            catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        }
 
         // try { colors = file.request_properties_from_element("vertex", { "red", "green", "blue", "alpha" }); }
         // catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
@@ -87,13 +93,25 @@ Mesh::Mesh(const std::string& plyFIlePath)
         // try { colors = file.request_properties_from_element("vertex", { "r", "g", "b", "a" }); }
         // catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
 
-        // try { texcoords = file.request_properties_from_element("vertex", { "u", "v" }); }
-        // catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        // UVs are optional and exporters name them differently, the first
+        // pair the file has is read
+        if (attributes & MeshTexCoords)
+        {
+            const std::vector<std::string> texcoordNames[] = { { "u", "v" }, { "s", "t" }, { "texture_u", "texture_v" } };
+            for (const auto & names : texcoordNames)
+            {
+                try { texcoords = file.request_properties_from_element("vertex", names); break; }
+                catch (const std::exception &) {}
+            }
+        }
 
         // Providing a list size hint (the last argument) is a 2x performance improvement. If you have 
         // arbitrary ply files, it is best to leave this 0. 
-        try { faces = file.request_properties_from_element("face", { "vertex_indices" }, 3); }
-        catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        if (attributes & MeshIndices)
+        {
+            try { faces = file.request_properties_from_element("face", { "vertex_indices" }, 3); }
+            catch (const std::exception & e) { std::cerr << "tinyply exception: " << e.what() << std::endl; }
+        }
 
         // Tristrips must always be read with a 0 list size hint (unless you know exactly how many elements
         // are specifically in the file, which is unlikely); 
@@ -110,17 +128,25 @@ Mesh::Mesh(const std::string& plyFIlePath)
         if (tripstrip)  std::cout << "\tRead " << (tripstrip->buffer.size_bytes() / tinyply::PropertyTable[tripstrip->t].stride) << " total indices (tristrip) " << std::endl;
 
         {
-            const size_t numVerticesBytes = vertices->buffer.size_bytes();
-            m_Vertices.resize(vertices->count);
-            std::memcpy(m_Vertices.data(), vertices->buffer.get(), numVerticesBytes);
+            if (vertices)
+            {
+                const size_t numVerticesBytes = vertices->buffer.size_bytes();
+                m_Vertices.resize(vertices->count);
+                std::memcpy(m_Vertices.data(), vertices->buffer.get(), numVerticesBytes);
+            }
+
+            // Without positions the vertex count comes from the header
+            size_t vertexCount = 0;
+            for (const auto & e : file.get_elements())
+                if (e.name == "vertex") vertexCount = e.size;
 
-            if (normals && normals->count == m_Vertices.size())
+            if (normals && normals->count == vertexCount)
             {
                 const size_t numNormalsBytes = normals->buffer.size_bytes();
                 m_Normals.resize(normals->count);
                 std::memcpy(m_Normals.data(), normals->buffer.get(), numNormalsBytes);
             }
-            else
+            else if (attributes & MeshNormals)
             {
                 std::cout << "[Error]: Normals count != Vertices count" << std::endl;
             }
@@ -143,19 +169,19 @@ Mesh::Mesh(const std::string& plyFIlePath)
                 }
                 // Add more types if needed
             }
-            else
+            else if (attributes & MeshIndices)
             {
                 std::cout << "[Error]: Normals count != Vertices count" << std::endl;
             }
             
 
-            if (texcoords && texcoords->count == m_Vertices.size()) 
+            if (texcoords && texcoords->count == vertexCount) 
             {
                 const size_t numTexcoordBytes = texcoords->buffer.size_bytes();
                 m_TexCoords.resize(texcoords->count);
                 std::memcpy(m_TexCoords.data(), texcoords->buffer.get(), numTexcoordBytes);
             }
-            else
+            else if (texcoords)
             {
                 std::cout << "[Error]: TexCoord count != Vertices count" << std::endl;
             }
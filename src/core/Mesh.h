@@ -5,13 +5,28 @@
 #include <string>
 #include <iostream>
 
+// Parts of a .ply file to read, loaders that convert one attribute at a time
+// skip the others
+enum MeshAttributes : uint32_t
+{
+    MeshPositions       = 1 << 0,
+    MeshNormals         = 1 << 1,
+    MeshTexCoords       = 1 << 2,
+    MeshIndices         = 1 << 3,
+    MeshAllAttributes   = MeshPositions | MeshNormals | MeshTexCoords | MeshIndices
+};
+
 class Mesh
 {
 public:
-    Mesh(const std::string& plyFilePath);
+    Mesh(const std::string& plyFilePath, uint32_t attributes = MeshAllAttributes);
     const std::vector<glm::vec3>&   GetVertices()   const { return m_Vertices;          }
     const std::vector<glm::vec3>&   GetNormals()    const { return m_Normals;           }
+    // Empty when the file has no per-vertex UVs
+    const std::vector<glm::vec2>&   GetTexCoords()  const { return m_TexCoords;         }
     const std::vector<uint32_t>&    GetIndices()    const { return m_TriangleIndices;   }
+    // Moves the indices out instead of copying them, the mesh has none afterwards
+    std::vector<uint32_t>           ReleaseIndices()      { return std::move(m_TriangleIndices); }
 private:
     const std::string m_PlyFilePath;
     std::vector<glm::vec3> m_Vertices;
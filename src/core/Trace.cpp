@@ -0,0 +1,178 @@
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Events kept per thread, about 20 passes of tiles for a 1080p render worker
+constexpr static uint64_t bufferCapacity = 1 << 15;
+
+static std::atomic<bool> traceEnabled{ true };
+
+namespace
+{
+
+// Relaxed atomics, the exporter reads slots the owner may be writing
+struct TraceSlot
+{
+    std::atomic<const char*> Name{ nullptr };
+    std::atomic<uint64_t> Begin{ 0 };
+    std::atomic<uint64_t> End{ 0 };
+};
+
+// Only the owning thread writes the slots and the head. A slot is filled
+// before the head moves past it.
+struct TraceBuffer
+{
+    const char* ThreadName = nullptr;
+    uint32_t Row = 0;
+    // Guarded by the registry mutex
+    bool InUse = false;
+    std::atomic<uint64_t> Head{ 0 };
+    std::unique_ptr<TraceSlot[]> Slots{ new TraceSlot[bufferCapacity] };
+};
+
+struct TraceRegistry
+{
+    std::mutex Mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> Buffers;
+};
+
+// Never destroyed, threads may still release their buffer during exit
+TraceRegistry& GetRegistry()
+{
+    static TraceRegistry* registry = new TraceRegistry;
+    return *registry;
+}
+
+TraceBuffer* AcquireBuffer(const char* name)
+{
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Mutex);
+    for (auto& buffer : registry.Buffers)
+    {
+        if (!buffer->InUse && !std::strcmp(buffer->ThreadName, name))
+        {
+            buffer->InUse = true;
+            return buffer.get();
+        }
+    }
+
+    auto buffer = std::make_unique<TraceBuffer>();
+    buffer->ThreadName = name;
+    buffer->Row = (uint32_t)registry.Buffers.size() + 1;
+    buffer->InUse = true;
+    registry.Buffers.push_back(std::move(buffer));
+    return registry.Buffers.back().get();
+}
+
+struct ThreadState
+{
+    const char* Name = "Thread";
+    TraceBuffer* Buffer = nullptr;
+
+    ~ThreadState() { Release(); }
+
+    void Release()
+    {
+        if (!Buffer)
+            return;
+        std::lock_guard<std::mutex> lock(GetRegistry().Mutex);
+        Buffer->InUse = false;
+        Buffer = nullptr;
+    }
+};
+
+thread_local ThreadState threadState;
+
+}
+
+void Trace::SetEnabled(bool enabled)
+{
+    traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Trace::IsEnabled()
+{
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void Trace::SetThreadName(const char* name)
+{
+    if (threadState.Buffer && std::strcmp(threadState.Buffer->ThreadName, name))
+        threadState.Release();
+    threadState.Name = name;
+}
+
+void Trace::AddEvent(const char* name, uint64_t begin, uint64_t end)
+{
+    if (!threadState.Buffer)
+        threadState.Buffer = AcquireBuffer(threadState.Name);
+
+    auto& buffer = *threadState.Buffer;
+    uint64_t head = buffer.Head.load(std::memory_order_relaxed);
+    auto& slot = buffer.Slots[head % bufferCapacity];
+    slot.Name.store(name, std::memory_order_relaxed);
+    slot.Begin.store(begin, std::memory_order_relaxed);
+    slot.End.store(end, std::memory_order_relaxed);
+    buffer.Head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::WriteChromeTrace(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+
+    struct Event
+    {
+        const char* Name;
+        uint64_t Begin, End;
+    };
+    std::vector<Event> events;
+
+    // The lock keeps the buffer list stable, writers only take it to get or
+    // return a buffer
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Mutex);
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"PBRman\"}}";
+    file.setf(std::ios::fixed);
+    file.precision(3);
+
+    for (const auto& buffer : registry.Buffers)
+    {
+        file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->Row
+             << ", \"args\": {\"name\": \"" << buffer->ThreadName << "\"}}";
+
+        uint64_t head = buffer->Head.load(std::memory_order_acquire);
+        uint64_t first = head > bufferCapacity ? head - bufferCapacity : 0;
+        events.clear();
+        for (uint64_t i = first; i < head; i++)
+        {
+            const auto& slot = buffer->Slots[i % bufferCapacity];
+            events.push_back({
+                slot.Name.load(std::memory_order_relaxed),
+                slot.Begin.load(std::memory_order_relaxed),
+                slot.End.load(std::memory_order_relaxed)
+            });
+        }
+
+        // The owner kept writing during the copy, slots up to the one it may
+        // be filling now can hold newer events than the ones copied
+        uint64_t headAfter = buffer->Head.load(std::memory_order_acquire);
+        uint64_t firstValid = headAfter + 1 > bufferCapacity ? headAfter + 1 - bufferCapacity : 0;
+        for (uint64_t i = std::max(first, firstValid); i < head; i++)
+        {
+            const auto& event = events[i - first];
+            file << ",\n{\"name\": \"" << event.Name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->Row
+                 << ", \"ts\": " << event.Begin * 1e-3 << ", \"dur\": " << (event.End - event.Begin) * 1e-3 << "}";
+        }
+    }
+
+    file << "\n]}\n";
+    return (bool)file;
+}
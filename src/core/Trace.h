@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Scoped timeline markers, exported as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). Recording is compiled in with PBRMAN_TRACE, see
+// src/CMakeLists.txt. Without it the macros below expand to nothing.
+//
+// Every thread writes into its own ring buffer, a marker is two clock reads
+// and three relaxed stores. The newest events of each thread survive, so a
+// trace exported right after a hitch shows the frames around it.
+class Trace
+{
+public:
+    // Nanoseconds since the first call in the process
+    static uint64_t Now()
+    {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Recording is on from the start
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+
+    // Names the timeline row of the calling thread. Buffers of finished
+    // threads are reused by new threads of the same name, so short-lived pool
+    // threads share a few rows instead of adding one per pass. The name must
+    // outlive the process, use string literals.
+    static void SetThreadName(const char* name);
+
+    // name must be a string literal, only the pointer is stored
+    static void AddEvent(const char* name, uint64_t begin, uint64_t end);
+
+    // Writes the buffered events of all threads, returns false if the file
+    // could not be written
+    static bool WriteChromeTrace(const std::string& path);
+};
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : m_Name(name), m_Enabled(Trace::IsEnabled()), m_Begin(m_Enabled ? Trace::Now() : 0) {}
+    ~TraceScope()
+    {
+        if (m_Enabled)
+            Trace::AddEvent(m_Name, m_Begin, Trace::Now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_Name;
+    bool m_Enabled;
+    uint64_t m_Begin;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef PBRMAN_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Trace::SetThreadName(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
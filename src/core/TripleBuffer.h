@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. The producer and the consumer own a buffer each and swap
+// it with the shared one, so neither ever waits for the other and the
+// consumer always sees the newest published value.
+template<typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+    void Publish()
+    {
+        uint32_t previous = m_Shared.exchange(m_WriteIndex | newBit, std::memory_order_acq_rel);
+        m_WriteIndex = previous & indexMask;
+    }
+
+    // Consumer side, returns false when nothing was published since the last
+    // call and the read buffer stays as it was
+    bool Acquire()
+    {
+        if ((m_Shared.load(std::memory_order_relaxed) & newBit) == 0)
+            return false;
+        uint32_t previous = m_Shared.exchange(m_ReadIndex, std::memory_order_acq_rel);
+        m_ReadIndex = previous & indexMask;
+        return true;
+    }
+    const T& GetReadBuffer() const { return m_Buffers[m_ReadIndex]; }
+
+private:
+    constexpr static uint32_t newBit = 4;
+    constexpr static uint32_t indexMask = 3;
+
+    T m_Buffers[3];
+    uint32_t m_WriteIndex = 0;
+    uint32_t m_ReadIndex = 1;
+    std::atomic<uint32_t> m_Shared{ 2 };
+};
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <fstream>
 
 #include <GLFW/glfw3.h>
 #define GLFW_EXPOSE_NATIVE_WIN32
@@ -21,8 +22,9 @@
 #include "RasterEngine/Image.h"
 #include "RayTracing/Camera.h"
 #include "RayTracing/Scene.h"
-#include "RayTracing/RayRenderer.h"
+#include "RayTracing/RenderThread.h"
 #include "RasterEngine/Pipeline.h"
+#include "core/Trace.h"
 
 // Vertex structure
 struct Vertex {
@@ -101,26 +103,16 @@ std::shared_ptr<Scene> scene;
 // Image
 std::shared_ptr<Image> image;
 uint32_t* imageData = nullptr;
-float* accumulationData = nullptr;
+
+std::shared_ptr<RenderThread> renderThread;
 
 // ImGui objects
 std::shared_ptr<ImGui_NVRHI> nvrhiImgui;
 
-glm::vec3 RRTAndODTFit(const glm::vec3& v) {
-    glm::vec3 a = v * (v + 0.0245786f) - 0.000090537f;
-    glm::vec3 b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
-    return a / b;
-};
-
-glm::vec3 toneMapACES(const glm::vec3& color) {
-    const float exposure = 1.0f;  // or compute per-scene
-    glm::vec3 mapped = RRTAndODTFit(color * exposure);
-    return mapped;
-    return glm::clamp(mapped, 0.0f, 1.0f);  // use your clamp
-};
-
-static int accumulateCount = 0;
 static int BVHDebugDepth = 0;
+static RenderSettings renderSettings;
+// Last camera state handed to the render thread
+static uint32_t renderCameraVersion = 0;
 
 int main() {
 
@@ -138,71 +130,52 @@ int main() {
 
     ImGuiIO& io = ImGui::GetIO(); (void)io;
 
-
-    RayRenderer renderer;
-
+    TRACE_THREAD_NAME("Main thread");
     while(!glfwWindowShouldClose(window)) {
+        TRACE_SCOPE("Frame");
         static std::chrono::high_resolution_clock::time_point lastTime = std::chrono::high_resolution_clock::now();
         auto startTime = std::chrono::high_resolution_clock::now();
         auto deltaTime = std::chrono::duration<float>(startTime - lastTime).count();
         lastTime = startTime;
 
-        glfwPollEvents();
-
-        accumulateCount++;
-        renderer.Render(accumulationData, scene, camera, accumulateCount);
-        
-        auto width = camera->GetWidth();
-        auto height = camera->GetHeight();
-        for (uint32_t i = 0; i < width; i++)
-            for (uint32_t j = 0; j < height; j++)
-            {
-
-                auto r = accumulationData[(i + j * (uint32_t)width) * 3];
-                auto g = accumulationData[(i + j * (uint32_t)width) * 3 + 1];
-                auto b = accumulationData[(i + j * (uint32_t)width) * 3 + 2];
-
-                glm::vec3 rgb{ r, g, b};
-
-                // Tonemap Reinhard
-                // rgb = rgb / (glm::vec3(1.0f) + rgb);
-
-                // Tonemapping ACES
-                rgb = toneMapACES(rgb);
-
-                // Gamma Correction
-                rgb = glm::pow(rgb, glm::vec3{1.0f / 2.2f});
-
-                // Clamp values
-                rgb = glm::clamp(rgb, 0.0f, 1.0f);
-
-                auto colori = 
-                    static_cast<uint32_t>(rgb.r * 255.0f) << 0 |
-                    static_cast<uint32_t>(rgb.g * 255.0f) << 8 |
-                    static_cast<uint32_t>(rgb.b * 255.0f) << 16 |
-                    0xFF000000;
-
-                imageData[i + j * (uint32_t)width] = colori;
-            }
+        {
+            TRACE_SCOPE("Poll events");
+            glfwPollEvents();
+        }
 
-        image->SetData(imageData);
-        auto imageUploadFenceValue = ++fenceValue;
-        ThrowIfFailed(commandQueue->Signal(frameFence.Get(), imageUploadFenceValue));
-        WaitForFenceValue(frameFence, imageUploadFenceValue, frameFenceEvent);
+        // Upload the newest frame of the render thread, if there is one
+        if (renderThread->AcquireFrame())
+        {
+            TRACE_SCOPE("Upload image");
+            image->SetData(renderThread->GetFrame().Pixels.data());
+            auto imageUploadFenceValue = ++fenceValue;
+            ThrowIfFailed(commandQueue->Signal(frameFence.Get(), imageUploadFenceValue));
+            WaitForFenceValue(frameFence, imageUploadFenceValue, frameFenceEvent);
+        }
 
-        UpdateImgui();
+        {
+            TRACE_SCOPE("ImGui");
+            UpdateImgui();
+        }
 
         camera->Update(0.5f);
+        if (camera->GetVersion() != renderCameraVersion)
+        {
+            renderThread->SetCamera(*camera);
+            renderCameraVersion = camera->GetVersion();
+        }
 
        
         std::vector<CubeAABB> cubes;
-
-        scene->GetBVH().Traverse([&](int depth, const AABB& bound) {
-            if (depth == BVHDebugDepth)
-                cubes.push_back({
-                    bound.Min, bound.Max
-                });
-        });
+        {
+            TRACE_SCOPE("BVH debug cubes");
+            scene->GetBVH().Traverse([&](int depth, const AABB& bound) {
+                if (depth == BVHDebugDepth)
+                    cubes.push_back({
+                        bound.Min, bound.Max
+                    });
+            });
+        }
 
         // cubes.push_back({
         //     glm::vec3{ -1.0f, -1.0f, -1.0f },
@@ -210,6 +183,7 @@ int main() {
         // });
 
         // Quad render pass
+        TRACE_SCOPE("Render and present");
         commandList->open();
         commandList->beginMarker("Quad Texture Render Pass");
         quadPipeline->Render(commandList, camera->GetWidth(), camera->GetHeight());
@@ -218,8 +192,11 @@ int main() {
         cubePipeline->Render(commandList, cubes, {camera->GetViewProjection()}, camera->GetWidth(), camera->GetHeight());
         commandList->endMarker();
         commandList->close();
-        nvrhiDevice->executeCommandList(commandList);
-        nvrhiDevice->waitForIdle();
+        {
+            TRACE_SCOPE("Quad pass");
+            nvrhiDevice->executeCommandList(commandList);
+            nvrhiDevice->waitForIdle();
+        }
 
         // Get the current back buffer
         auto backBufferIndex = swapChain->GetCurrentBackBufferIndex();
@@ -238,7 +215,10 @@ int main() {
         commandList->close();
         nvrhiDevice->executeCommandList(commandList);
 
-        nvrhiImgui->render(backFrameBuffer);
+        {
+            TRACE_SCOPE("ImGui render");
+            nvrhiImgui->render(backFrameBuffer);
+        }
 
         // Update and Render additional Platform Windows
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
@@ -257,11 +237,13 @@ int main() {
 
 
         backBufferIndex = swapChain->GetCurrentBackBufferIndex();
+        TRACE_SCOPE("Wait for back buffer");
         WaitForFenceValue(frameFence, frameFenceValue[backBufferIndex], frameFenceEvent);
 
     }
 
     // Cleanup
+    renderThread->Stop();
     glfwDestroyWindow(window);
     glfwTerminate();
 
@@ -403,11 +385,6 @@ void CreateSwapChainRenderTargets()
         {
             imageData[i] = 0xFF000000; // ABGR
         }
-        accumulationData = new float[viewportWidth * viewportHeight * 3];
-        for (uint32_t i = 0; i < viewportWidth * viewportHeight * 3; ++i)
-        {
-            accumulationData[i] = 0.0f; // ABGR
-        }
         
         image = std::make_shared<Image>(viewportWidth, viewportHeight, nvrhiDevice, commandList);
         image->SetData(imageData);
@@ -425,10 +402,14 @@ void CreateSwapChainRenderTargets()
             glm::normalize(focus - center),
             viewportWidth,
             viewportHeight,
-            100.0f
+            glm::length(focus - center)
         );
 
         scene = std::make_shared<Scene>();
+
+        renderThread = std::make_shared<RenderThread>(scene, *camera);
+        renderCameraVersion = camera->GetVersion();
+        renderThread->Start();
     }
     
     void InitImgui() 
@@ -598,6 +579,7 @@ void UpdateImgui()
     if (show_demo_window)
         ImGui::ShowDemoWindow(&show_demo_window);
 
+    bool resetAccumulation = false;
     // 2. Show a simple window that we create ourselves. We use a Begin/End pair to create a named window.
     {
         static float f = 0.0f;
@@ -612,6 +594,65 @@ void UpdateImgui()
         ImGui::SliderFloat("float", &f, 0.0f, 1.0f);            // Edit 1 float using a slider from 0.0f to 1.0f
         ImGui::SliderInt("BVH Debug Depth", &BVHDebugDepth, 0, 10);
 
+        // Sampler and filter changes restart the accumulation on the render thread
+        bool settingsChanged = false;
+        const char* samplerNames[] = { "Independent", "Stratified", "Sobol", "Blue Noise" };
+        settingsChanged |= ImGui::Combo("Sampler", (int*)&renderSettings.Sampler, samplerNames, IM_ARRAYSIZE(samplerNames));
+        const char* filterNames[] = { "Box", "Tent", "Gaussian" };
+        settingsChanged |= ImGui::Combo("Filter", (int*)&renderSettings.Filter, filterNames, IM_ARRAYSIZE(filterNames));
+
+        const char* integratorNames[] = { "Path Tracing", "Traversal Cost" };
+        settingsChanged |= ImGui::Combo("Integrator", (int*)&renderSettings.IntegratorType, integratorNames, IM_ARRAYSIZE(integratorNames));
+        if (renderSettings.IntegratorType == Integrator::TraversalCost)
+        {
+            const char* metricNames[] = { "BVH Nodes", "Primitive Tests" };
+            settingsChanged |= ImGui::Combo("Heatmap Metric", (int*)&renderSettings.Metric, metricNames, IM_ARRAYSIZE(metricNames));
+            settingsChanged |= ImGui::SliderFloat("Heatmap Scale", &renderSettings.HeatmapScale, 1.0f, 1000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        }
+
+        const char* outputNames[] = { "Color", "Albedo", "Normal", "Depth", "Position", "Sample Count" };
+        settingsChanged |= ImGui::Combo("Display", &renderSettings.DisplayOutput, outputNames, IM_ARRAYSIZE(outputNames));
+        settingsChanged |= ImGui::Checkbox("Denoise", &renderSettings.Denoise);
+        settingsChanged |= ImGui::Checkbox("Temporal Reprojection", &renderSettings.TemporalReprojection);
+        settingsChanged |= ImGui::SliderInt("Max History Samples", &renderSettings.MaxHistorySamples, 1, 256);
+        settingsChanged |= ImGui::Checkbox("Dynamic Resolution", &renderSettings.DynamicResolution);
+        settingsChanged |= ImGui::SliderFloat("Target Frame Time (ms)", &renderSettings.TargetFrameTime, 5.0f, 100.0f);
+        settingsChanged |= ImGui::Checkbox("Frame Budget", &renderSettings.FrameBudget);
+        if (settingsChanged)
+            renderThread->SetSettings(renderSettings);
+
+        const auto& frame = renderThread->GetFrame();
+        ImGui::Text("Pass %d, stride %u, %.1f ms", frame.PassIndex, frame.PixelStride, frame.RenderTime);
+
+        const char* projectionNames[] = { "Perspective", "Orthographic", "Environment" };
+        int projection = (int)camera->GetProjection();
+        if (ImGui::Combo("Projection", &projection, projectionNames, IM_ARRAYSIZE(projectionNames)))
+        {
+            camera->SetProjection((CameraProjection)projection);
+            resetAccumulation = true;
+        }
+
+        float fovY = glm::degrees(camera->GetFovY());
+        if (ImGui::SliderFloat("FOV", &fovY, 10.0f, 120.0f))
+        {
+            camera->SetFovY(glm::radians(fovY));
+            resetAccumulation = true;
+        }
+
+        float aperture = camera->GetAperture();
+        if (ImGui::SliderFloat("Aperture", &aperture, 0.0f, 1.0f))
+        {
+            camera->SetAperture(aperture);
+            resetAccumulation = true;
+        }
+
+        float focusDistance = camera->GetFocusDistance();
+        if (ImGui::SliderFloat("Focus Distance", &focusDistance, 0.1f, 50.0f))
+        {
+            camera->SetFocusDistance(focusDistance);
+            resetAccumulation = true;
+        }
+
         if (ImGui::Button("Button"))                            // Buttons return true when clicked (most widgets return true when edited/activated)
             counter++;
         ImGui::SameLine();
@@ -621,7 +662,53 @@ void UpdateImgui()
         ImGui::End();
     }
 
-    bool cameraUpdated = false;
+    // Counters of the last pass of the render thread
+    {
+        ImGui::Begin("Render Statistics");
+        const auto& frame = renderThread->GetFrame();
+        const auto& stats = frame.Stats;
+        if (!RenderStats::enabled)
+        {
+            ImGui::Text("Built without PBRMAN_RENDER_STATS");
+        }
+        else
+        {
+            uint64_t rays = stats.GetRayCount();
+            double perRay = rays > 0 ? 1.0 / (double)rays : 0.0;
+            ImGui::Text("%.2f Mrays/s", frame.RenderTime > 0.0f ? (double)rays / (frame.RenderTime * 1000.0) : 0.0);
+            ImGui::Text("Camera rays %llu, indirect rays %llu", (unsigned long long)stats[RenderCounter::CameraRays], (unsigned long long)stats[RenderCounter::IndirectRays]);
+            ImGui::Text("Nodes per ray %.2f", stats[RenderCounter::NodesVisited] * perRay);
+            ImGui::Text("Primitive tests per ray %.2f", stats[RenderCounter::PrimitiveTests] * perRay);
+            ImGui::Text("Hit rate %.3f", stats[RenderCounter::Hits] * perRay);
+            ImGui::Text("Max path depth %llu", (unsigned long long)stats.MaxPathDepth);
+
+            if (ImGui::Button("Dump JSON"))
+            {
+                std::ofstream file("render_stats.json");
+                file << RenderStats::ToJSON(stats, frame.RenderTime) << std::endl;
+                std::cout << "Render statistics written to render_stats.json" << std::endl;
+            }
+        }
+
+        // Open the file in chrome://tracing or ui.perfetto.dev
+        ImGui::Separator();
+#ifdef PBRMAN_TRACE
+        static bool traceEnabled = Trace::IsEnabled();
+        if (ImGui::Checkbox("Record Trace", &traceEnabled))
+            Trace::SetEnabled(traceEnabled);
+        if (ImGui::Button("Export Trace"))
+        {
+            if (Trace::WriteChromeTrace("trace.json"))
+                std::cout << "Trace written to trace.json" << std::endl;
+            else
+                std::cout << "Could not write trace.json" << std::endl;
+        }
+#else
+        ImGui::Text("Built without PBRMAN_TRACE");
+#endif
+        ImGui::End();
+    }
+
     // 3. Show another simple window.
     if (show_image)
     {
@@ -655,7 +742,6 @@ void UpdateImgui()
         {
             float speed = 0.7f; // Adjust zoom speed as needed
             camera->Zoom(io.MouseWheel * speed);
-            cameraUpdated = true;
         }
 
         if (hovering && leftMousedragging)
@@ -665,7 +751,6 @@ void UpdateImgui()
             camera->Rotate(
                 -delta.y * speed / width, 
                 -delta.x * speed / height);
-            cameraUpdated = true;
         }
 
         if (hovering && rightMousedragging)
@@ -675,19 +760,14 @@ void UpdateImgui()
             camera->Translate(
                 -delta.x * speed / width, 
                 delta.y * speed / height);
-            cameraUpdated = true;
         }
 
         ImGui::End();
         ImGui::PopStyleVar();
     }
-    if (cameraUpdated)
-    {
-        accumulateCount = 0;
-        for (uint32_t i = 0; i < viewportWidth * viewportHeight * 3; ++i)
-        {
-            accumulationData[i] = 0.0f;
-        }
-    }
+    // Camera motion is handed over after Camera::Update, the render thread
+    // reprojects or clears the film then
+    if (resetAccumulation)
+        renderThread->ResetAccumulation();
     ImGui::Render();
 }
\ No newline at end of file
@@ -0,0 +1,438 @@
+// Headless render regression harness.
+//
+// Renders a fixed list of views of the default scene through the path tracer
+// at a fixed sample count. The samplers are seeded by pixel and sample index,
+// so repeated runs of one build trace the same paths. For every case it
+// records wall time and camera samples per second, and compares the image
+// against a stored reference rendered at a much higher sample count. Peak
+// memory is a process wide high-water mark and is reported once per run.
+//
+// Time to quality is the render time until the RMSE against the reference
+// first drops below the target of the case, measured after every pass. The
+// pass count it takes depends on the paths, not on the speed of the machine,
+// so it catches changes in convergence. The time catches changes in speed.
+//
+// References live in assets/references, <case>.pfm next to <case>.txt with
+// the sample count, final RMSE and passes to quality they were recorded with.
+// Other compilers and instruction sets can round differently and trace
+// slightly different paths, so results are compared with tolerances instead
+// of exactly. The references are committed and only rewritten with
+// --update-references, once a change of the image is known to be intended.
+//
+// Timings depend on the machine. They live in <baselines>/<case>.txt, are
+// written with --update-baselines and stay out of version control. Without a
+// baseline the timing checks are skipped.
+//
+// A run fails when a reference is missing, the final RMSE grew past its
+// tolerance, the target is reached more than one pass later, or the time to
+// quality got slower than the tolerance. Faster runs are reported but do not
+// fail.
+//
+// Like the viewer, the scene loads its meshes relative to the working
+// directory, run the harness from the same directory.
+
+#include "RayTracing/RayRenderer.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+constexpr static uint32_t imageWidth = 160;
+constexpr static uint32_t imageHeight = 120;
+constexpr static int defaultSampleCount = 32;
+constexpr static int defaultReferenceSampleCount = 1024;
+// Allowed relative growth of the final RMSE and the time to quality
+constexpr static double defaultTolerance = 0.1;
+// Passes to quality may differ by this much before a run fails, the RMSE of a
+// pass close to the target can land on either side of it
+constexpr static int passesToQualityTolerance = 1;
+
+struct RegressionCase
+{
+    const char* Name;
+    glm::vec3 Position;
+    glm::vec3 Target;
+    CameraProjection Projection;
+    float Aperture;
+    // RMSE of the compressed radiance that counts as converged enough
+    float TargetRMSE;
+};
+
+static const RegressionCase regressionCases[] = {
+    { "overview",       { 5.0f, 5.0f, 8.0f },   { 0.0f, 0.0f, 0.0f },  CameraProjection::Perspective,  0.0f, 0.04f },
+    { "meshes",         { 0.0f, 2.5f, 4.0f },   { 0.0f, 1.5f, 0.0f },  CameraProjection::Perspective,  0.0f, 0.04f },
+    { "dielectric",     { 2.0f, 1.5f, 7.0f },   { 0.0f, 1.0f, 4.0f },  CameraProjection::Perspective,  0.0f, 0.04f },
+    { "depth-of-field", { 5.0f, 5.0f, 8.0f },   { 0.0f, 0.0f, 0.0f },  CameraProjection::Perspective,  0.3f, 0.04f },
+    { "environment",    { 0.0f, 3.0f, 0.0f },   { 0.0f, 3.0f, -1.0f }, CameraProjection::Environment,  0.0f, 0.04f },
+};
+
+struct CaseResult
+{
+    int Passes = 0;
+    double RenderTime = 0.0;    // ms
+    // Camera samples, the render counters are not compiled into the harness
+    double MsamplesPerSecond = 0.0;
+    double FinalRMSE = 0.0;
+    // Passes and ms until the RMSE first reached the target, 0 when it never did
+    int PassesToQuality = 0;
+    double TimeToQuality = 0.0;
+};
+
+static double GetPeakMemoryMB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0.0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;    // kB on Linux
+#endif
+}
+
+// Little-endian PFM, rows bottom to top
+static bool WritePFM(const std::string& path, const std::vector<glm::vec3>& pixels, uint32_t width, uint32_t height)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+    for (uint32_t y = height; y-- > 0;)
+        file.write((const char*)&pixels[(size_t)y * width], width * sizeof(glm::vec3));
+    return (bool)file;
+}
+
+static bool ReadPFM(const std::string& path, std::vector<glm::vec3>& pixels, uint32_t width, uint32_t height)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    uint32_t fileWidth = 0, fileHeight = 0;
+    float scale = 0.0f;
+    file >> magic >> fileWidth >> fileHeight >> scale;
+    file.get();
+    if (!file || magic != "PF" || scale >= 0.0f || fileWidth != width || fileHeight != height)
+        return false;
+
+    pixels.resize((size_t)width * height);
+    for (uint32_t y = height; y-- > 0;)
+        file.read((char*)&pixels[(size_t)y * width], width * sizeof(glm::vec3));
+    return (bool)file;
+}
+
+static bool ReadBaseline(const std::string& path, CaseResult& result)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::map<std::string, double> values;
+    std::string key;
+    double value;
+    while (file >> key >> value)
+        values[key] = value;
+
+    result.Passes = (int)values["passes"];
+    result.RenderTime = values["renderTimeMs"];
+    result.MsamplesPerSecond = values["msamplesPerSecond"];
+    result.FinalRMSE = values["finalRMSE"];
+    result.PassesToQuality = (int)values["passesToQuality"];
+    result.TimeToQuality = values["timeToQualityMs"];
+    return true;
+}
+
+// The machine independent part of a result, stored with the reference image
+static bool WriteReferenceResult(const std::string& path, const CaseResult& result)
+{
+    std::ofstream file(path);
+    file << "passes " << result.Passes << "\n"
+         << "finalRMSE " << result.FinalRMSE << "\n"
+         << "passesToQuality " << result.PassesToQuality << "\n";
+    return (bool)file;
+}
+
+static bool WriteBaseline(const std::string& path, const CaseResult& result)
+{
+    std::ofstream file(path);
+    file << "passes " << result.Passes << "\n"
+         << "renderTimeMs " << result.RenderTime << "\n"
+         << "msamplesPerSecond " << result.MsamplesPerSecond << "\n"
+         << "passesToQuality " << result.PassesToQuality << "\n"
+         << "timeToQualityMs " << result.TimeToQuality << "\n";
+    return (bool)file;
+}
+
+// Radiance is compressed with c / (1 + c) first, so a few fireflies do not
+// dominate the error
+static double ComputeRMSE(const std::vector<glm::vec3>& image, const std::vector<glm::vec3>& reference)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        glm::vec3 a = image[i] / (1.0f + image[i]);
+        glm::vec3 b = reference[i] / (1.0f + reference[i]);
+        glm::vec3 d = a - b;
+        sum += (double)glm::dot(d, d) / 3.0;
+    }
+    return std::sqrt(sum / std::max<size_t>(1, image.size()));
+}
+
+static std::shared_ptr<Camera> CreateCamera(const RegressionCase& regressionCase)
+{
+    auto camera = std::make_shared<Camera>(
+        regressionCase.Position,
+        glm::normalize(regressionCase.Target - regressionCase.Position),
+        (float)imageWidth,
+        (float)imageHeight,
+        glm::length(regressionCase.Target - regressionCase.Position)
+    );
+    camera->SetProjection(regressionCase.Projection);
+    camera->SetAperture(regressionCase.Aperture);
+    return camera;
+}
+
+static void ReadFilm(const Film& film, std::vector<glm::vec3>& pixels)
+{
+    pixels.resize((size_t)film.GetWidth() * film.GetHeight());
+    for (uint32_t y = 0; y < film.GetHeight(); y++)
+        for (uint32_t x = 0; x < film.GetWidth(); x++)
+            pixels[(size_t)y * film.GetWidth() + x] = film.GetPixelColor(x, y);
+}
+
+// Renders sampleCount passes. With a reference the RMSE is measured after
+// every pass, outside the timed render calls.
+static CaseResult RenderCase(std::shared_ptr<Scene> scene, const RegressionCase& regressionCase, int sampleCount,
+    const std::vector<glm::vec3>* reference, std::vector<glm::vec3>& image)
+{
+    auto camera = CreateCamera(regressionCase);
+    RayRenderer renderer;
+    Film film(imageWidth, imageHeight);
+
+    CaseResult result;
+    result.Passes = sampleCount;
+    for (int pass = 1; pass <= sampleCount; pass++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        renderer.Render(film, scene, camera, pass);
+        auto end = std::chrono::high_resolution_clock::now();
+        result.RenderTime += std::chrono::duration<double, std::milli>(end - start).count();
+
+        if (reference && result.PassesToQuality == 0)
+        {
+            ReadFilm(film, image);
+            if (ComputeRMSE(image, *reference) <= regressionCase.TargetRMSE)
+            {
+                result.PassesToQuality = pass;
+                result.TimeToQuality = result.RenderTime;
+            }
+        }
+    }
+
+    ReadFilm(film, image);
+    double cameraSamples = (double)imageWidth * imageHeight * result.Passes;
+    result.MsamplesPerSecond = result.RenderTime > 0.0 ? cameraSamples / (result.RenderTime * 1000.0) : 0.0;
+    if (reference)
+        result.FinalRMSE = ComputeRMSE(image, *reference);
+    return result;
+}
+
+static void PrintResult(const char* name, const CaseResult& result)
+{
+    std::printf("%-16s %5d spp %10.1f ms %8.3f Msamples/s  rmse %.5f  quality ",
+        name, result.Passes, result.RenderTime, result.MsamplesPerSecond, result.FinalRMSE);
+    if (result.PassesToQuality > 0)
+        std::printf("%d spp %.1f ms\n", result.PassesToQuality, result.TimeToQuality);
+    else
+        std::printf("not reached\n");
+}
+
+// Returns false when the image got worse than the reference result
+static bool CompareWithReference(const CaseResult& result, const CaseResult& expected, double tolerance)
+{
+    if (result.Passes != expected.Passes)
+    {
+        std::cout << "    FAIL reference result was recorded at " << expected.Passes << " spp, run with --spp " << expected.Passes << std::endl;
+        return false;
+    }
+
+    bool passed = true;
+    if (result.FinalRMSE > expected.FinalRMSE * (1.0 + tolerance))
+    {
+        std::cout << "    FAIL RMSE " << result.FinalRMSE << " vs reference result " << expected.FinalRMSE << std::endl;
+        passed = false;
+    }
+
+    if (result.PassesToQuality != expected.PassesToQuality)
+    {
+        auto describe = [](int passes) { return passes > 0 ? std::to_string(passes) + " spp" : std::string("never"); };
+        bool worse = (result.PassesToQuality == 0 && expected.PassesToQuality != 0) ||
+            (expected.PassesToQuality != 0 && result.PassesToQuality > expected.PassesToQuality + passesToQualityTolerance);
+        std::cout << (worse ? "    FAIL " : "    NOTE ") << "target RMSE reached after " << describe(result.PassesToQuality)
+                  << ", reference result " << describe(expected.PassesToQuality) << std::endl;
+        passed = passed && !worse;
+    }
+    return passed;
+}
+
+// Returns false for slower runs, faster runs only print a note
+static bool CompareWithBaseline(const CaseResult& result, const CaseResult& baseline, double tolerance)
+{
+    // Times are only comparable for the same amount of work
+    if (result.Passes != baseline.Passes || result.PassesToQuality != baseline.PassesToQuality ||
+        result.PassesToQuality == 0 || baseline.TimeToQuality <= 0.0)
+    {
+        std::cout << "    NOTE baseline is for a different sample count or convergence, timing not compared" << std::endl;
+        return true;
+    }
+
+    double change = result.TimeToQuality / baseline.TimeToQuality - 1.0;
+    if (std::abs(change) <= tolerance)
+        return true;
+
+    std::ostringstream message;
+    message.precision(1);
+    message << std::fixed << "time to quality " << result.TimeToQuality << " ms vs baseline "
+            << baseline.TimeToQuality << " ms (" << (change > 0.0 ? "+" : "") << change * 100.0 << "%)";
+    std::cout << (change > 0.0 ? "    FAIL " : "    NOTE ") << message.str() << std::endl;
+    return change <= 0.0;
+}
+
+static void PrintUsage()
+{
+    std::cout << "Usage: PBRmanRegress [--references <dir>] [--baselines <dir>] [--spp <count>] [--reference-spp <count>]\n"
+                 "                     [--tolerance <fraction>] [--case <name>] [--output <dir>]\n"
+                 "                     [--update-references] [--update-baselines]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string referenceDirectory = RUNTIME_DIRECTORY "assets/references";
+    std::string baselineDirectory = "regress-baselines";
+    std::string outputDirectory;
+    std::string caseFilter;
+    int sampleCount = defaultSampleCount;
+    int referenceSampleCount = defaultReferenceSampleCount;
+    double tolerance = defaultTolerance;
+    bool updateReferences = false;
+    bool updateBaselines = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--references") && hasValue)
+            referenceDirectory = argv[++i];
+        else if (!std::strcmp(argv[i], "--baselines") && hasValue)
+            baselineDirectory = argv[++i];
+        else if (!std::strcmp(argv[i], "--spp") && hasValue)
+            sampleCount = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--reference-spp") && hasValue)
+            referenceSampleCount = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--tolerance") && hasValue)
+            tolerance = std::atof(argv[++i]);
+        else if (!std::strcmp(argv[i], "--case") && hasValue)
+            caseFilter = argv[++i];
+        else if (!std::strcmp(argv[i], "--output") && hasValue)
+            outputDirectory = argv[++i];
+        else if (!std::strcmp(argv[i], "--update-references"))
+            updateReferences = true;
+        else if (!std::strcmp(argv[i], "--update-baselines"))
+            updateBaselines = true;
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    auto scene = std::make_shared<Scene>();
+    auto buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+    std::printf("Scene load and BVH build %.1f ms\n", buildTime);
+
+    if (updateReferences)
+        std::filesystem::create_directories(referenceDirectory);
+    if (updateBaselines)
+        std::filesystem::create_directories(baselineDirectory);
+    if (!outputDirectory.empty())
+        std::filesystem::create_directories(outputDirectory);
+
+    int failureCount = 0;
+    for (const auto& regressionCase : regressionCases)
+    {
+        if (!caseFilter.empty() && caseFilter != regressionCase.Name)
+            continue;
+
+        std::string referencePath = referenceDirectory + "/" + regressionCase.Name;
+        std::string baselinePath = baselineDirectory + "/" + regressionCase.Name + ".txt";
+        std::vector<glm::vec3> reference, image;
+
+        if (updateReferences)
+        {
+            std::cout << regressionCase.Name << ": rendering reference at " << referenceSampleCount << " spp" << std::endl;
+            RenderCase(scene, regressionCase, referenceSampleCount, nullptr, reference);
+            if (!WritePFM(referencePath + ".pfm", reference, imageWidth, imageHeight))
+            {
+                std::cout << "    FAIL could not write " << referencePath << ".pfm" << std::endl;
+                failureCount++;
+                continue;
+            }
+        }
+        else if (!ReadPFM(referencePath + ".pfm", reference, imageWidth, imageHeight))
+        {
+            std::cout << regressionCase.Name << ": FAIL no reference at " << referencePath << ".pfm" << std::endl;
+            failureCount++;
+            continue;
+        }
+
+        auto result = RenderCase(scene, regressionCase, sampleCount, &reference, image);
+        PrintResult(regressionCase.Name, result);
+
+        if (!outputDirectory.empty())
+            WritePFM(outputDirectory + "/" + regressionCase.Name + ".pfm", image, imageWidth, imageHeight);
+
+        if (updateReferences)
+            WriteReferenceResult(referencePath + ".txt", result);
+        if (updateBaselines)
+            WriteBaseline(baselinePath, result);
+        if (updateReferences || updateBaselines)
+            continue;
+
+        CaseResult expected;
+        if (!ReadBaseline(referencePath + ".txt", expected))
+        {
+            std::cout << "    FAIL no reference result at " << referencePath << ".txt" << std::endl;
+            failureCount++;
+            continue;
+        }
+        bool passed = CompareWithReference(result, expected, tolerance);
+
+        CaseResult baseline;
+        if (!ReadBaseline(baselinePath, baseline))
+            std::cout << "    NOTE no timing baseline at " << baselinePath << ", run with --update-baselines to record one" << std::endl;
+        else
+            passed = CompareWithBaseline(result, baseline, tolerance) && passed;
+
+        if (!passed)
+            failureCount++;
+    }
+
+    std::printf("Peak memory %.1f MB\n", GetPeakMemoryMB());
+
+    if (failureCount > 0)
+        std::cout << failureCount << " case(s) failed" << std::endl;
+    return failureCount > 0 ? 1 : 0;
+}